@@ -18,6 +18,12 @@
 #include <stdint.h>
 
 namespace rgb_matrix {
+// A pixel to be set with Canvas::SetPixels().
+struct Pixel {
+  int x, y;
+  uint8_t red, green, blue;
+};
+
 // An interface for things a Canvas can do. The RGBMatrix implements this
 // interface, so you can use it directly wherever a canvas is needed.
 //
@@ -46,6 +52,43 @@ public:
 
   // Fill screen with given 24bpp color.
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) = 0;
+
+  // Set "length" pixels starting at (x,y) towards the right to the given
+  // color. Pixels outside the canvas are ignored.
+  // The default implementation calls SetPixel() for each pixel;
+  // implementations that can do better, such as the FrameCanvas that only
+  // converts the color once and writes whole runs, override it.
+  virtual void FillSpan(int x, int y, int length,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    if (y < 0 || y >= height()) return;
+    if (x < 0) {
+      length += x;
+      x = 0;
+    }
+    if (x + length > width()) length = width() - x;
+    for (int i = 0; i < length; ++i) {
+      SetPixel(x + i, y, red, green, blue);
+    }
+  }
+
+  // Set "count" pixels with their individual position and color.
+  // Allows to hand over many pixels in one call through layers of
+  // delegating canvases. The default implementation calls SetPixel().
+  virtual void SetPixels(const Pixel *pixels, int count) {
+    for (int i = 0; i < count; ++i) {
+      const Pixel &p = pixels[i];
+      SetPixel(p.x, p.y, p.red, p.green, p.blue);
+    }
+  }
+
+  // Set "length" pixels starting at (x,y) towards the right to the colors
+  // in "rgb", which contains three bytes red, green, blue for each pixel.
+  // The default implementation calls SetPixel().
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb) {
+    for (int i = 0; i < length; ++i, rgb += 3) {
+      SetPixel(x + i, y, rgb[0], rgb[1], rgb[2]);
+    }
+  }
 };
 
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
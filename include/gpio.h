@@ -100,10 +100,17 @@ public:
   //   need negative pulses, this is what it does)
   // "nano_wait_spec" contains a list of time periods we'd like
   //   invoke later. This can be used to pre-process timings if needed.
+  // "performance_governor" switches the refresh core to the performance
+  //   cpu frequency governor for the most stable timing.
+  // "scalable_pulses" prepares for pulses shortened with SetPulseScale(),
+  //   at the cost of a faster hardware PWM clock.
   static PinPulser *Create(GPIO *io, uint32_t gpio_mask,
                            bool allow_hardware_pulsing,
-                           const std::vector<int> &nano_wait_spec);
+                           const std::vector<int> &nano_wait_spec,
+                           bool performance_governor = true,
+                           bool scalable_pulses = false);
 
+  PinPulser() : pulse_scale_(kFullPulseScale) {}
   virtual ~PinPulser() {}
 
   // Send a pulse with a given length (index into nano_wait_spec array).
@@ -111,6 +118,29 @@ public:
 
   // If SendPulse() is asynchronously implemented, wait for pulse to finish.
   virtual void WaitPulseFinished() {}
+
+  // Scale the length of all pulses to a fraction of the nano_wait_spec
+  // given at creation, in 1/kFullPulseScale units. Can be called while
+  // pulses are sent; takes effect with the next pulse.
+  enum { kPulseScaleBits = 12, kFullPulseScale = 1 << kPulseScaleBits };
+  void SetPulseScale(int scale) {
+    pulse_scale_ = (scale < 1) ? 1
+      : ((scale > kFullPulseScale) ? kFullPulseScale : scale);
+  }
+
+  // Smallest pulse scale at which all pulses keep their relative lengths.
+  // Below, the shortest pulses can't get any shorter.
+  virtual int MinProportionalScale() const { return 1; }
+
+protected:
+  // Scale the given pulse length with the current pulse scale, rounded.
+  inline uint32_t ScaledPulse(uint32_t value) const {
+    return ((uint64_t)value * pulse_scale_ + kFullPulseScale / 2)
+      >> kPulseScaleBits;
+  }
+
+private:
+  volatile int pulse_scale_;
 };
 
 // Get rolling over microsecond counter. We get this from a hardware register
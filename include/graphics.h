@@ -10,7 +10,9 @@
 #include "canvas.h"
 
 #include <map>
+#include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 namespace rgb_matrix {
 struct Color {
@@ -31,6 +33,15 @@ public:
 
   bool LoadFont(const char *path);
 
+  // Load a font in the compiled format written by WriteCompiledFont(), e.g.
+  // with the font-compiler utility. The file is mmap()ed and glyphs are only
+  // decoded once they are used, so this is fast even for fonts with many
+  // thousand glyphs. Only possible on a Font that has nothing loaded yet.
+  bool LoadCompiledFont(const char *path);
+
+  // Write this font in the compiled format. Returns 'true' on success.
+  bool WriteCompiledFont(const char *path) const;
+
   // Return height of font in pixels. Returns -1 if font has not been loaded.
   int height() const { return font_height_; }
 
@@ -49,6 +60,9 @@ public:
   // available.
   // Returns how much we advance on the screen, which is the width of the
   // character or 0 if we didn't draw any chracter.
+  //
+  // Drawing on a FrameCanvas or RGBMatrix is fast: the colors are only
+  // converted when they change, and glyphs are written as a whole.
   int DrawGlyph(Canvas *c, int x, int y,
                 const Color &color, const Color *background_color,
                 uint32_t unicode_codepoint) const;
@@ -68,14 +82,49 @@ public:
 private:
   Font(const Font& x);  // No copy constructor. Use references or pointer instead.
 
-  struct Glyph;
-  typedef std::map<uint32_t, Glyph*> CodepointGlyphMap;
+  struct Glyph {
+    uint32_t codepoint;
+    int device_width, device_height;
+    int width, height;
+    int x_offset, y_offset;
+    const uint64_t *bitmap;  // 'height' rows.
+  };
 
+  // Returns glyph for codepoint or NULL if it doesn't exist.
   const Glyph *FindGlyph(uint32_t codepoint) const;
+  // Same, but returns the replacement character if it doesn't exist.
+  const Glyph *FindGlyphOrReplacement(uint32_t codepoint) const;
+  // Make the last glyph in glyphs_ the one for its codepoint.
+  void IndexLastGlyph();
+  // Number of entries in the page table.
+  uint32_t PageCount() const;
+  // Create outline of glyph "orig" in "out". The "out_rows" need to have
+  // space for two more rows than the original and are expected to be zeroed.
+  static void CreateOutlineGlyph(const Glyph &orig,
+                                 Glyph *out, uint64_t *out_rows);
+
+  // DrawGlyph() into a FrameCanvas or RGBMatrix, with prepared colors.
+  template <class PreparingCanvas>
+  int DrawPreparedGlyph(PreparingCanvas *canvas, int x, int y,
+                        const Color &color, const Color *background_color,
+                        const Glyph *glyph) const;
+
+  struct ColorCache;
+  struct CompiledFont;
 
   int font_height_;
   int base_line_;
-  CodepointGlyphMap glyphs_;
+
+  // All glyphs and their bitmaps are stored contiguously. Glyphs are found
+  // via a two-level table: codepoint / 256 indexes into page_start_, which
+  // is the start of the 256 entries of that page in glyph_index_.
+  std::vector<Glyph> glyphs_;
+  std::vector<uint64_t> bitmaps_;
+  std::vector<int32_t> page_start_;   // -1 if no glyph in that page.
+  std::vector<int32_t> glyph_index_;  // Index into glyphs_ or -1.
+  const Glyph *replacement_glyph_;
+  CompiledFont *compiled_;  // Fonts from LoadCompiledFont() use this instead.
+  mutable ColorCache *color_cache_;  // Last colors prepared for drawing.
 };
 
 // -- Some utility functions.
@@ -113,6 +162,27 @@ void DrawCircle(Canvas *c, int x, int y, int radius, const Color &color);
 // Draw a line from "x0", "y0" to "x1", "y1" and with "color"
 void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color);
 
+// Draw a horizontal line of "length" pixels starting at "x", "y" towards the
+// right.
+void DrawHLine(Canvas *c, int x, int y, int length, const Color &color);
+
+// Draw a vertical line of "length" pixels starting at "x", "y" downwards.
+void DrawVLine(Canvas *c, int x, int y, int length, const Color &color);
+
+// Fill rectangle with the top left corner "x", "y" of the given size.
+void FillRect(Canvas *c, int x, int y, int width, int height,
+              const Color &color);
+
+// Fill circle centered at "x", "y", with a radius of "radius". Covers the
+// same pixels as DrawCircle() and everything inside.
+void FillCircle(Canvas *c, int x, int y, int radius, const Color &color);
+
+// Fill the polygon with "count" corners at "xs[i]", "ys[i]". Pixels are
+// filled if their center is inside the polygon, using the even-odd rule
+// for self-intersecting polygons.
+void FillPolygon(Canvas *c, const int *xs, const int *ys, int count,
+                 const Color &color);
+
 }  // namespace rgb_matrix
 
 #endif  // RPI_GRAPHICS_H
@@ -100,6 +100,18 @@ struct RGBLedMatrixOptions {
    */
   int pwm_dither_bits;
 
+  /* Spatial dithering with pwm_bits below 11.
+   * 0 = off, 1 = ordered (Bayer), 2 = blue noise.
+   * Corresponding flag: --led-dither
+   */
+  int dither;
+
+  /* Refresh rate to fall back to for frames that didn't change for a
+   * second. 0 = always refresh at full speed.
+   * Corresponding flag: --led-idle-refresh-hz
+   */
+  int idle_refresh_hz;
+
   /* The initial brightness of the panel in percent. Valid range is 1..100
    * Corresponding flag: --led-brightness
    */
@@ -120,6 +132,12 @@ struct RGBLedMatrixOptions {
    */
   int multiplexing;
 
+  /* Alternatively, the name or description of the multiplexing. If set,
+   * takes precedence over the number above.
+   * Corresponding flag: --led-multiplexing (non-numeric)
+   */
+  const char *multiplexing_name;
+
   /* In case the internal sequence of mapping is not "RGB", this contains the
    * real mapping. Some panels mix up these colors.
    */
@@ -137,6 +155,12 @@ struct RGBLedMatrixOptions {
    */
   const char *panel_type;  /* Corresponding flag: --led-panel-type */
 
+  /* Directory to cache the final pixel mapping in, so that it does not
+   * have to be re-computed on each start.
+   * Corresponding flag: --led-pixel-mapping-cache
+   */
+  const char *pixel_mapping_cache;
+
   /** The following are boolean flags, all off by default **/
 
   /* Allow to use the hardware subsystem to create pulses. This won't do
@@ -147,6 +171,9 @@ struct RGBLedMatrixOptions {
   unsigned show_refresh_rate:1;  /* Corresponding flag: --led-show-refresh    */
   // unsigned swap_green_blue:1; /* deprecated, use led_sequence instead */
   unsigned inverse_colors:1;     /* Corresponding flag: --led-inverse         */
+  unsigned pulse_brightness:1;   /* Corresponding flag: --led-pulse-brightness */
+  unsigned low_power_idle:1;     /* Corresponding flag: --led-low-power-idle  */
+  unsigned huge_pages:1;         /* Corresponding flag: --led-huge-pages      */
 };
 
 /**
@@ -230,6 +257,68 @@ void led_canvas_get_size(const struct LedCanvas *canvas,
 void led_canvas_set_pixel(struct LedCanvas *canvas, int x, int y,
 			  uint8_t r, uint8_t g, uint8_t b);
 
+/** A pixel with position and color for led_canvas_set_pixels(). */
+struct LedPixel {
+  int x, y;
+  uint8_t r, g, b;
+};
+
+/** Set "count" pixels, each with its own position and color. */
+void led_canvas_set_pixels(struct LedCanvas *canvas,
+                           const struct LedPixel *pixels, int count);
+
+/**
+ * Set "length" pixels starting at (x, y) towards the right to the colors
+ * in "rgb", which contains three bytes r, g, b per pixel.
+ */
+void led_canvas_set_row(struct LedCanvas *canvas, int x, int y, int length,
+                        const uint8_t *rgb);
+
+/**
+ * Set the PWM bits only for rows "y" .. "y + height - 1" of the canvas;
+ * lower bitplanes of these rows are skipped, increasing the refresh rate.
+ * Returns non-zero on success.
+ */
+int led_canvas_set_row_pwm_bits(struct LedCanvas *canvas, int y, int height,
+                                uint8_t value);
+
+/**
+ * Dither newly set pixels of the canvas if fewer than 11 pwm bits are used.
+ * "mode" 0 = off, 1 = ordered (Bayer), 2 = blue noise. Changing "phase"
+ * every frame also dithers over time.
+ */
+void led_canvas_set_dither(struct LedCanvas *canvas, int mode,
+                           unsigned phase);
+
+/**
+ * Set entry "index" of the 256 color palette of the canvas. If "recolor" is
+ * non-zero, pixels showing the previous color of that entry are changed.
+ */
+void led_canvas_set_palette_color(struct LedCanvas *canvas, uint8_t index,
+                                  uint8_t r, uint8_t g, uint8_t b,
+                                  int recolor);
+
+/**
+ * Set "length" pixels starting at (x, y) towards the right to the palette
+ * colors given in "indices".
+ */
+void led_canvas_set_indexed_row(struct LedCanvas *canvas, int x, int y,
+                                int length, const uint8_t *indices);
+
+/**
+ * Get color of pixel at (x, y). This is reconstructed from what is shown,
+ * so can differ slightly from what was set. Returns 0 if outside canvas.
+ */
+int led_canvas_get_pixel(struct LedCanvas *canvas, int x, int y,
+                         uint8_t *r, uint8_t *g, uint8_t *b);
+
+/**
+ * Get the colors of the "width" x "height" rectangle at (x, y) into "rgb",
+ * row by row with three bytes r, g, b per pixel.
+ */
+void led_canvas_get_image(struct LedCanvas *canvas, int x, int y,
+                          int width, int height, uint8_t *rgb);
+
 /** Clear screen (black). */
 void led_canvas_clear(struct LedCanvas *canvas);
 
@@ -259,6 +348,43 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * Like led_matrix_create_offscreen_canvas(), but re-uses a canvas handed
+ * back with led_matrix_release_canvas() if available.
+ */
+struct LedCanvas *led_matrix_acquire_canvas(struct RGBLedMatrix *matrix);
+
+/**
+ * Hand back a canvas that is not needed anymore. Returns 0 if the canvas
+ * is still shown, about to be shown or used as overlay.
+ */
+int led_matrix_release_canvas(struct RGBLedMatrix *matrix,
+                              struct LedCanvas *canvas);
+
+/**
+ * Show the pixels of canvas "overlay" marked with led_canvas_set_overlay_mask()
+ * on top of the active canvas. NULL removes the overlay.
+ */
+void led_matrix_set_overlay(struct RGBLedMatrix *matrix,
+                            struct LedCanvas *overlay);
+
+/**
+ * Mark a rectangle of a canvas used as overlay as shown ("visible" non-zero)
+ * or transparent.
+ */
+void led_canvas_set_overlay_mask(struct LedCanvas *canvas, int x, int y,
+                                 int width, int height, int visible);
+
+/**
+ * Cross-fade from canvas "from" (NULL: the currently active one) to "to"
+ * within "duration_us" microseconds. Blocks until done and returns the
+ * previously active canvas, like led_matrix_swap_on_vsync().
+ */
+struct LedCanvas *led_matrix_cross_fade(struct RGBLedMatrix *matrix,
+                                        struct LedCanvas *from,
+                                        struct LedCanvas *to,
+                                        uint32_t duration_us);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
@@ -276,6 +402,12 @@ void draw_circle(struct LedCanvas *c, int xx, int y, int radius, uint8_t r, uint
 
 void draw_line(struct LedCanvas *c, int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b);
 
+void fill_rect(struct LedCanvas *c, int x, int y, int width, int height, uint8_t r, uint8_t g, uint8_t b);
+
+void fill_circle(struct LedCanvas *c, int x, int y, int radius, uint8_t r, uint8_t g, uint8_t b);
+
+void fill_polygon(struct LedCanvas *c, const int *xs, const int *ys, int count, uint8_t r, uint8_t g, uint8_t b);
+
 #ifdef  __cplusplus
 }  // extern C
 #endif
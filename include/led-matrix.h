@@ -32,12 +32,26 @@
 namespace rgb_matrix {
 class RGBMatrix;
 class FrameCanvas;   // Canvas for Double- and Multibuffering
+class RgbFrameCanvas;  // Canvas with plain RGB content.
 
 namespace internal {
 class Framebuffer;
 class PixelDesignatorMap;
 }
 
+// A color converted for a FrameCanvas with FrameCanvas::PrepareColor().
+// Setting pixels with a prepared color skips the color conversion with
+// luminance correction, brightness and inversion; worthwhile if many pixels
+// have the same color.
+// If these settings changed since it was prepared, the color is converted
+// again for each pixel; so it is always correct, but only fast while current.
+struct PreparedColor {
+  PreparedColor() : red(0), green(0), blue(0), color_settings(0xffffffff) {}
+  uint8_t red, green, blue;  // The original color.
+  uint32_t color_settings;   // Settings the planes were prepared for.
+  uint8_t planes[11];        // For each bitplane: bit 0 red, 1 green, 2 blue.
+};
+
 // The RGB matrix provides the framebuffer and the facilities to constantly
 // update the LED matrix.
 //
@@ -107,6 +121,21 @@ public:
     // Flag: --led-pwm-dither-bits
     int pwm_dither_bits;
 
+    // With pwm_bits below 11, approximate the levels in between with a
+    // spatial dither pattern; see FrameCanvas::SetDither().
+    // 0 = off, 1 = ordered (Bayer), 2 = blue noise. Default: 0
+    // Flag: --led-dither
+    int dither;
+
+    // Refresh rate in Hz to fall back to once the shown frame has not
+    // changed for a second. This lowers the duty cycle (and brightness) of
+    // static content to save power. Only new frames from SwapOnVSync(),
+    // CrossFade() or SetOverlay() count as change; pixels drawn directly
+    // on the shown canvas still appear, but at this rate.
+    // 0 = always refresh at full speed. Default: 0
+    // Flag: --led-idle-refresh-hz
+    int idle_refresh_hz;
+
     // The initial brightness of the panel in percent. Valid range is 1..100
     // Default: 100
     // Flag: --led-brightness
@@ -123,6 +152,10 @@ public:
 
     // Type of multiplexing. 0 = direct, 1 = stripe, 2 = checker (typical 1:8)
     int multiplexing;
+    // Alternatively, the name of the multiplexing or a description of it
+    // in the form "<stretch-factor>,<x-expression>,<y-expression>".
+    // If set, takes precedence over the number above.
+    const char *multiplexing_name;  // Flag: --led-multiplexing (non-numeric)
 
     // Disable the PWM hardware subsystem to create pulses.
     // Typically, you don't want to disable hardware pulsing, this is mostly
@@ -136,6 +169,31 @@ public:
     // bool swap_green_blue; (Deprecated: use led_sequence instead)
     bool inverse_colors;       // Flag: --led-inverse
 
+    // Apply the brightness by shortening the output enable pulses instead
+    // of scaling the colors. Changes of the brightness then take effect with
+    // the next refresh without drawing again, and dimming doesn't lose
+    // color depth down to about a quarter of the light output (with
+    // hardware pulses; a brightness of about 60 with luminance correction).
+    // The pulses of the lowest bitplanes can't get any shorter than that;
+    // the dimming below is applied to the colors like without this option,
+    // so it only shows for pixels drawn afterwards.
+    // With hardware pulses, this runs the PWM clock up to four times faster.
+    bool pulse_brightness;     // Flag: --led-pulse-brightness
+
+    // Stop refreshing while the shown frame is all black until there is
+    // something to show again, and don't switch the refresh core to the
+    // performance cpu governor. For battery powered uses.
+    // A frame only counts as black after Clear() or Fill() with black;
+    // drawing black pixels over content doesn't stop the refresh. With
+    // inverse_colors, the refresh never stops.
+    bool low_power_idle;       // Flag: --led-low-power-idle
+
+    // Allocate the memory of each FrameCanvas in huge pages (see
+    // /proc/sys/vm/nr_hugepages), to avoid TLB misses while drawing and
+    // refreshing. As each FrameCanvas then takes at least one huge page
+    // (typically 2MiB), this is only useful for large displays.
+    bool huge_pages;           // Flag: --led-huge-pages
+
     // In case the internal sequence of mapping is not "RGB", this contains the
     // real mapping. Some panels mix up these colors.
     const char *led_rgb_sequence;  // Flag: --led-rgb-sequence
@@ -148,6 +206,14 @@ public:
     // Panel type. Typically an empty string or NULL, but some panels need
     // a particular initialization sequence, so this is used for that.
     const char *panel_type;  // Flag: --led-panel-type
+
+    // Directory in which the final pixel mapping (multiplexing plus all
+    // pixel mappers) is cached. On startup, a matching cached mapping is
+    // loaded instead of being re-computed, which is noticeably faster for
+    // large displays. NULL or empty string: no caching.
+    // Files used with the "File" pixel mapper are identified by their size
+    // and modification time, so edits to them are picked up.
+    const char *pixel_mapping_cache;  // Flag: --led-pixel-mapping-cache
   };
 
   // Create an RGBMatrix.
@@ -211,11 +277,36 @@ public:
   // Returns a boolean indicating if this was successful.
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
+  // Precompute an alternative pixel mapping to switch to at runtime with
+  // SwitchPixelMapping(), e.g. one Rotate mapper for each orientation.
+  // The new mapping is the mapping set up so far (the one with id 0)
+  // with "mapper" applied on top. Returns the id of the mapping or -1 if
+  // the mapper can't be applied.
+  // After the first call, ApplyPixelMapper() is not possible anymore.
+  int PrecomputePixelMapping(const PixelMapper *mapper);
+
+  // Switch to a mapping created with PrecomputePixelMapping() (or back to
+  // the initial mapping with id 0). The mapping itself is not computed
+  // again, but the content of all FrameCanvases is re-arranged so that
+  // pixels keep their (x,y) position in the new mapping: this costs a
+  // copy of each created FrameCanvas, proportional to its number of pixels.
+  // The displayed frame changes at the next VSync, together with the
+  // mapping used for drawing. No other thread may draw on any FrameCanvas
+  // while this runs.
+  // Note, the width() and height() of the canvases might change, and
+  // settings tied to their rows, FrameCanvas::SetRowPWMBits() and the
+  // overlay mask, are reset. RgbFrameCanvases are resized as well and
+  // converted completely with their next submit.
+  // Returns 'false' if there is no mapping with that id.
+  bool SwitchPixelMapping(int id);
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // limited comic-colors, 1 might be sufficient. Lower require less CPU and
   // increases refresh-rate.
   //
-  // Returns boolean to signify if value was within range.
+  // Returns boolean to signify if value was within range. If the library is
+  // compiled with a compact BITPLANE_WORD_BITS (see lib/Makefile), the range
+  // is limited to the pwm_bits the matrix was created with.
   //
   // This sets the PWM bits for the current active FrameCanvas and future
   // ones that are created with CreateFrameCanvas().
@@ -227,10 +318,16 @@ public:
   bool luminance_correct() const;
 
   // Set brightness in percent for all created FrameCanvas. 1%..100%.
-  // This will only affect newly set pixels.
+  // This will only affect newly set pixels; unless the pulse_brightness
+  // option is set, then it applies to the whole output with the next refresh.
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Set palette entry for indexed colors in all FrameCanvas created so far.
+  // See FrameCanvas::SetPaletteColor().
+  void SetPaletteColor(uint8_t index, uint8_t red, uint8_t green, uint8_t blue,
+                       bool recolor = false);
+
   //-- GPIO interaction
 
   // Return pointer to GPIO object for your own interaction with free
@@ -273,6 +370,24 @@ public:
   // don't have to worry about deleting them.
   FrameCanvas *CreateFrameCanvas();
 
+  // FrameCanvas pool for programs that only need FrameCanvases temporarily,
+  // e.g. for transient animations, without growing memory.
+  //
+  // Get a FrameCanvas released before with ReleaseFrameCanvas(), or a newly
+  // created one if there is none. Its settings are the current defaults like
+  // with CreateFrameCanvas(), but its content is undefined.
+  FrameCanvas *AcquireFrameCanvas();
+
+  // Give back a FrameCanvas that is not needed anymore. It is kept for the
+  // next AcquireFrameCanvas() or, if there are already as many waiting as
+  // the pool size, deleted. It must not be used anymore afterwards.
+  // Returns false, and keeps the canvas as is, if it is shown, about to be
+  // shown or used as overlay.
+  bool ReleaseFrameCanvas(FrameCanvas *canvas);
+
+  // Maximum number of released FrameCanvases kept for re-use. Default: 4.
+  void SetFrameCanvasPoolSize(int size);
+
   // This method waits to the next VSync and swaps the active buffer with the
   // supplied buffer. The formerly active buffer is returned.
   //
@@ -289,6 +404,49 @@ public:
   // 28Hz animation, nicely locked to the frame-rate).
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // Create a canvas that keeps its content as plain RGB (see RgbFrameCanvas)
+  // to be shown with SubmitOnVSync(). Its size is the size of this
+  // RGBMatrix. The ownership remains with the RGBMatrix.
+  RgbFrameCanvas *CreateRgbFrameCanvas();
+
+  // Convert the rows of "canvas" changed since it was last submitted to
+  // bitplanes and show the result with the next VSync, like SwapOnVSync().
+  // The conversion is spread over the CPUs not used by the refresh thread.
+  // When this returns, "canvas" can be drawn on again right away.
+  void SubmitOnVSync(RgbFrameCanvas *canvas, unsigned framerate_fraction = 1);
+
+  // Cross-fade from FrameCanvas "from" (NULL: the one currently shown) to
+  // "to" within "duration_us" microseconds. The blending happens in the
+  // refresh loop by showing bitplanes of both frames over time, so it costs
+  // no drawing or color conversion; neither canvas must be changed while
+  // fading. Both should use the same pwm bits.
+  // Waits until "to" is shown on its own, like SwapOnVSync(), and returns
+  // the FrameCanvas that was shown before.
+  FrameCanvas *CrossFade(FrameCanvas *from, FrameCanvas *to,
+                         uint32_t duration_us);
+
+  // Show the pixels of "overlay" that are marked in its overlay mask on
+  // top of whatever FrameCanvas is shown (see FrameCanvas::SetOverlayMask()).
+  // This is merged while sending the data to the panel, so base frames and
+  // overlay can be updated independently, e.g. for a clock or status
+  // display. The overlay can be drawn on while shown. NULL: no overlay.
+  // Takes effect with the next refresh, which this waits for; afterwards,
+  // a previous overlay is not used anymore. The overlay should use the same
+  // pwm bits as the other frames.
+  void SetOverlay(FrameCanvas *overlay);
+
+  // Prepare a color to be used with SetPixel() below.
+  void PrepareColor(uint8_t red, uint8_t green, uint8_t blue,
+                    PreparedColor *color);
+  // Set pixel at (x,y) to a color prepared with PrepareColor().
+  void SetPixel(int x, int y, const PreparedColor &color);
+  // See FrameCanvas::color_settings() and FrameCanvas::DrawBitmap(); these
+  // work on the active FrameCanvas.
+  uint32_t color_settings() const;
+  void DrawBitmap(int x, int y, int width, int height, const uint64_t *rows,
+                  const PreparedColor &foreground,
+                  const PreparedColor *background = NULL);
+
   // -- Canvas interface. These write to the active FrameCanvas
   // (see documentation in canvas.h)
   virtual int width() const;
@@ -297,6 +455,10 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillSpan(int x, int y, int length,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(const Pixel *pixels, int count);
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb);
 
 
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
@@ -317,18 +479,27 @@ public:
 private:
   class UpdateThread;
   friend class UpdateThread;
+  class RowConverter;
 
   // Apply pixel mappers that have been passed down via a configuration
   // string.
   void ApplyNamedPixelMappers(const char *pixel_mapper_config,
                               int chain, int parallel);
 
+  // Set PWM bits, brightness etc. of a new or re-used canvas from params_.
+  void ApplyFrameCanvasDefaults(FrameCanvas *canvas);
+
+  // With the pulse_brightness option, apply params_.brightness to the
+  // output enable pulses, and the rest of it to the colors.
+  void ApplyPulseBrightness();
+
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
   void ApplyStaticTransformerDeprecated(const CanvasTransformer &transformer);
 #endif  // REMOVE_DEPRECATED_TRANSFORMERS
 
   Options params_;
   bool do_luminance_correct_;
+  uint8_t pulse_color_brightness_;  // Colors' share of pulse brightness.
 
   FrameCanvas *active_;
 
@@ -340,6 +511,13 @@ private:
   UpdateThread *updater_;
   std::vector<FrameCanvas*> created_frames_;
   internal::PixelDesignatorMap *shared_pixel_mapper_;
+  // Mappings to switch between; includes shared_pixel_mapper_ if not empty.
+  std::vector<internal::PixelDesignatorMap*> pixel_mappings_;
+  const int stored_planes_;  // Bitplanes stored in each FrameCanvas.
+  std::vector<FrameCanvas*> canvas_pool_;  // Released, ready for re-use.
+  size_t canvas_pool_size_;
+  std::vector<RgbFrameCanvas*> created_rgb_frames_;
+  RowConverter *row_converter_;  // Created with the first RgbFrameCanvas.
 };
 
 class FrameCanvas : public Canvas {
@@ -351,6 +529,16 @@ public:
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();
 
+  // Set PWM bits for the rows "y" .. "y + height - 1" only, e.g. 1 bit for
+  // rows with simple text next to rows with video. The lower bitplanes of
+  // these rows are skipped when refreshing, which increases the refresh
+  // rate of the whole display. The brightness of the remaining bits stays
+  // the same; levels are rounded down.
+  // This works on the physical rows of the panels that show these pixels;
+  // depending on the pixel mapping, these can be shared with other rows.
+  // Never shows more than pwmbits(). Returns false if out of range.
+  bool SetRowPWMBits(int y, int height, uint8_t value);
+
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on);
   bool luminance_correct() const;
@@ -358,6 +546,29 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Dither newly set pixels if fewer than 11 pwm bits are used: levels in
+  // between the ones that can be shown are approximated by a fine pattern,
+  // so content at 6 bits looks close to 11 bits, without the color banding.
+  // Mode 0 = off, 1 = ordered (Bayer), 2 = blue noise (less visible).
+  // Applies to SetPixel(), SetRow(), Fill() and friends, but not to
+  // prepared or palette colors. Returns false if mode is out of range.
+  bool SetDither(int mode);
+  int dither() const;
+
+  // Shift the dither pattern. Setting a different phase for each frame
+  // (e.g. a frame counter) makes the dithering spatio-temporal: each pixel
+  // toggles between neighboring levels over time, averaging out.
+  void SetDitherPhase(unsigned phase);
+
+  //-- Use as overlay, see RGBMatrix::SetOverlay(). Only pixels in the
+  // overlay mask are shown on top; initially none.
+
+  // Mark the rectangle at (x,y) with the given size as shown or transparent.
+  void SetOverlayMask(int x, int y, int width, int height, bool visible);
+  // Mark all pixels that are currently not black as shown, black ones as
+  // transparent.
+  void SetOverlayMaskFromContent();
+
   //-- Serialize()/Deserialize() are fast ways to store and re-create a canvas.
 
   // Provides a pointer to a buffer of the internal representation to
@@ -382,6 +593,78 @@ public:
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  //-- Moving content around. These work on the already prepared bitplanes,
+  // which is much cheaper than drawing everything again; e.g. a scrolling
+  // marquee only needs to draw the newly visible column.
+
+  // Copy the rectangle at "x","y" with the given size to "dst_x","dst_y".
+  // Source and destination may overlap.
+  void CopyRegion(int x, int y, int width, int height, int dst_x, int dst_y);
+
+  // Move the content of the rectangle at "x","y" with the given size by
+  // "dx","dy" pixels. The area uncovered is filled with the given color.
+  void ScrollRegion(int x, int y, int width, int height, int dx, int dy,
+                    uint8_t red = 0, uint8_t green = 0, uint8_t blue = 0);
+
+  // Move the whole content by "dx","dy" pixels, e.g. Scroll(-1, 0) to
+  // scroll one pixel to the left. Fastest if the full height is scrolled
+  // horizontally.
+  void Scroll(int dx, int dy,
+              uint8_t red = 0, uint8_t green = 0, uint8_t blue = 0);
+
+  //-- Indexed colors. If content only has a limited set of colors, these
+  // can be set up in a palette of 256 entries, each converted only once.
+  // Pixels are then written by their 1-byte index.
+
+  // Set palette entry "index"; entries are black until set.
+  // If "recolor" is true, all pixels currently showing the previous color
+  // of that entry are changed to the new one; this allows palette
+  // animation without drawing again. Pixels are matched by their color,
+  // not by how they were drawn, so this includes pixels set with
+  // SetPixel() or another entry of the same color. Setting an entry for
+  // the first time never recolors.
+  void SetPaletteColor(uint8_t index, uint8_t red, uint8_t green, uint8_t blue,
+                       bool recolor = false);
+
+  // Set "length" pixels starting at (x,y) towards the right to the palette
+  // colors given in "indices".
+  void SetIndexedRow(int x, int y, int length, const uint8_t *indices);
+
+  //-- Reading back content.
+
+  // Get color of pixel at (x,y). The conversion done when setting the pixel
+  // (luminance correction, brightness, pwm bits) is inverted with the
+  // current settings. As it is lossy, the result can differ from what was
+  // set, but setting it again results in the same output.
+  // Returns false and black if (x,y) is outside the canvas.
+  bool GetPixel(int x, int y, uint8_t *red, uint8_t *green, uint8_t *blue);
+
+  // Get the colors of the "width" x "height" rectangle at (x,y) row by row
+  // into "rgb", three bytes red, green, blue per pixel.
+  void GetImage(int x, int y, int width, int height, uint8_t *rgb);
+
+  // Get the levels of pixel (x,y) as actually shown, each in the range
+  // 0..2047, without inverting the color conversion.
+  bool GetPixelLevels(int x, int y,
+                      uint16_t *red, uint16_t *green, uint16_t *blue) const;
+
+  // Convert color for this FrameCanvas for use with SetPixel() below.
+  void PrepareColor(uint8_t red, uint8_t green, uint8_t blue,
+                    PreparedColor *color);
+  // Set pixel at (x,y) to a color prepared with PrepareColor().
+  void SetPixel(int x, int y, const PreparedColor &color);
+  // The settings colors are currently prepared for. A PreparedColor with
+  // a different color_settings is converted again whenever used.
+  uint32_t color_settings() const;
+
+  // Draw "height" rows of a one-bit bitmap at (x,y), e.g. a font glyph.
+  // Bit 63 of each row is the left-most pixel; up to "width" (max 64)
+  // pixels are drawn. Set bits are drawn in "foreground", others in
+  // "background" or left untouched if that is NULL.
+  void DrawBitmap(int x, int y, int width, int height, const uint64_t *rows,
+                  const PreparedColor &foreground,
+                  const PreparedColor *background = NULL);
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -389,6 +672,10 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillSpan(int x, int y, int length,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(const Pixel *pixels, int count);
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb);
 
 private:
   friend class RGBMatrix;
@@ -400,6 +687,55 @@ private:
   internal::Framebuffer *const frame_;
 };
 
+// A Canvas that keeps its content as plain RGB, three bytes per pixel. This
+// makes drawing cheap and allows direct access to the pixels, while the
+// conversion to the bitplanes shown on the matrix is done in bulk for all
+// rows changed when submitted with RGBMatrix::SubmitOnVSync().
+class RgbFrameCanvas : public Canvas {
+public:
+  // Pixel (x,y) is at rgb_data() + 3 * (y * width() + x), with the bytes
+  // red, green, blue. After writing there directly, mark the rows with
+  // MarkRowsChanged(); the Canvas methods below do that themselves.
+  uint8_t *rgb_data() { return &rgb_[0]; }
+  const uint8_t *rgb_data() const { return &rgb_[0]; }
+
+  // Mark rows "y" .. "y + height - 1" to be converted with the next submit.
+  // Also useful to apply changed brightness or pwm bits to all content.
+  void MarkRowsChanged(int y, int height);
+
+  // -- Canvas interface.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillSpan(int x, int y, int length,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb);
+
+private:
+  friend class RGBMatrix;
+
+  RgbFrameCanvas(FrameCanvas *first, FrameCanvas *second);
+  virtual ~RgbFrameCanvas() {}   // Owned by RGBMatrix.
+
+  // Adapt to the size of the FrameCanvases after a pixel mapping switch.
+  // Pixels keep their (x,y) position; all rows are converted again.
+  void Resize();
+
+  int width_;
+  int height_;
+  std::vector<uint8_t> rgb_;
+
+  // The content is converted into these alternately, so that one of them
+  // can be shown while the other is prepared.
+  FrameCanvas *frames_[2];
+  int next_frame_;  // Index of the one to convert into with the next submit.
+  // Per row: bit i is set if frames_[i] is not up to date.
+  std::vector<uint8_t> stale_rows_;
+};
+
 // Runtime options to simplify doing common things for many programs such as
 // dropping privileges and becoming a daemon.
 struct RuntimeOptions {
@@ -478,6 +814,18 @@ bool ParseOptionsFromFlags(int *argc, char ***argv,
                            RuntimeOptions *rt_options,
                            bool remove_consumed_flags = true);
 
+// Configure "options" to drive a wall of "panels_x" by "panels_y" panels
+// with the shortest possible chains: the panels are spread over as many
+// parallel chains as the hardware mapping in "options" supports.
+// Sets chain_length and parallel and prepends the "Balanced" pixel mapper
+// to the pixel_mapper_config. The new pixel_mapper_config string is
+// allocated with strdup() and not freed by the library; if needed, the
+// caller can free() it once done with the options.
+// This is what the --led-wall=<panels_x>x<panels_y> flag does.
+// Returns 'false' and appends a message to "err" if this is not possible.
+bool BalanceChainsForWall(int panels_x, int panels_y,
+                          RGBMatrix::Options *options, std::string *err);
+
 // Factory to create a matrix and possibly other things such as dropping
 // privileges and becoming a daemon.
 // Returns NULL, if there was a problem (a message then is written to stderr).
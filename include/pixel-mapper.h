@@ -77,6 +77,11 @@ public:
   // length and half height panel (32x16 -> 64x8).
   // The logic_x, logic_y are output parameters and guaranteed not to be
   // nullptr.
+  // Setting both to -1 marks the visible pixel as not connected to any LED.
+  //
+  // For large displays, this is called from multiple threads at the same
+  // time, so implementations need to be thread-safe (which they typically
+  // are, being stateless).
   virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
                                   int visible_x, int visible_y,
                                   int *matrix_x, int *matrix_y) const = 0;
@@ -100,11 +105,18 @@ std::vector<std::string> GetAvailablePixelMappers();
 // parametrized PixelMapper with that name. Returns NULL if mapper
 // can not be found or parameter is invalid.
 // Ownership of the returned object is _NOT_ transferred to the caller.
-// Current available mappers are "U-mapper" and "Rotate". The "Rotate"
-// gets a parameter denoting the angle.
+// Current available mappers are "U-mapper", "Rotate", "File" and "Balanced".
+// The "Rotate" gets a parameter denoting the angle, "File" the filename of the
+// mapping and "Balanced" the size of the wall in panels, e.g. "4x3".
 const PixelMapper *FindPixelMapper(const char *name,
                                    int chain, int parallel,
                                    const char *parameter = NULL);
+
+// Convert a pixel mapping in the text form accepted by the "File" mapper
+// into its compiled binary form, which is faster to load: it is mmap()ed
+// directly. Returns 'true' on success, otherwise prints errors to stderr.
+bool CompilePixelMappingFile(const char *csv_filename,
+                             const char *compiled_filename);
 }  // namespace rgb_matrix
 
 #endif  // RGBMATRIX_PIXEL_MAPPER
@@ -21,9 +21,19 @@
 
 #include "graphics.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "led-matrix.h"
+#include "thread.h"
 
 // The little question-mark box "�" for unknown code.
 static const uint32_t kUnicodeReplacementCodepoint = 0xFFFD;
@@ -33,32 +43,287 @@ static const uint32_t kUnicodeReplacementCodepoint = 0xFFFD;
 typedef uint64_t rowbitmap_t;
 
 namespace rgb_matrix {
-struct Font::Glyph {
-  int device_width, device_height;
-  int width, height;
-  int x_offset, y_offset;
-  rowbitmap_t bitmap[0];  // contains 'height' elements.
+static const int kGlyphsPerPage = 256;
+static const int kOutlineBorder = 1;
+
+// The colors last used for drawing glyphs, prepared for the color settings
+// of the canvas drawn on. This is all that can be prepared ahead: where a
+// glyph ends up in the framebuffer determines its gpio bits, so a glyph
+// cache would still need one write per pixel and bitplane when drawing.
+// Text is drawn in a few colors, e.g. alternating for highlights; entries
+// are replaced round-robin.
+struct Font::ColorCache {
+  static const uint32_t kNoBackground = 0xffffffff;
+  static const int kEntries = 4;
+  struct Entry {
+    Entry() : foreground_rgb(0), background_rgb(kNoBackground) {}
+    uint32_t foreground_rgb;
+    uint32_t background_rgb;   // kNoBackground if transparent.
+    PreparedColor foreground;  // Its color_settings are part of the key.
+    PreparedColor background;
+  };
+  ColorCache() : next_replaced(0) {}
+
+  Mutex mutex;
+  Entry entries[kEntries];
+  int next_replaced;
+};
+
+// Compiled font file. The header is followed by
+//   int32_t page_start[page_count];    Same meaning as Font::page_start_
+//   int32_t glyph_index[index_count];  Same meaning as Font::glyph_index_
+//   CompiledGlyph glyphs[glyph_count];
+//   uint8_t bitmaps[bitmap_bytes];     'row_bytes' per row, left-most first.
+// All numbers are in host byte order.
+static const char kCompiledFontMagic[8] = { 'R','G','B','F','N','T','1','\n' };
+struct CompiledFontHeader {
+  char magic[8];
+  int32_t font_height;
+  int32_t base_line;
+  uint32_t page_count;
+  uint32_t index_count;
+  uint32_t glyph_count;
+  uint32_t bitmap_bytes;
+};
+
+struct CompiledGlyph {
+  uint32_t codepoint;
+  int16_t device_width, device_height;
+  int16_t width, height;
+  int16_t x_offset, y_offset;
+  uint32_t bitmap_offset;   // Start in bitmaps section.
+  uint32_t row_bytes;       // Bytes per row; rest of the 64 bits are zero.
+};
+
+// A mmap()ed compiled font file, shared between a Font and the outline
+// fonts created from it.
+struct MappedFontFile {
+  MappedFontFile() : base(NULL), size(0), references(1) {}
+  ~MappedFontFile() { if (base) munmap(base, size); }
+
+  void Ref() { MutexLock l(&mutex); ++references; }
+  void Unref() {
+    bool last;
+    {
+      MutexLock l(&mutex);
+      last = (--references == 0);
+    }
+    if (last) delete this;
+  }
+
+  void *base;
+  size_t size;
+  const CompiledFontHeader *header;
+  const int32_t *page_start;
+  const int32_t *glyph_index;
+  const CompiledGlyph *glyphs;
+  const uint8_t *bitmaps;
+
+  Mutex mutex;
+  int references;
+};
+
+static MappedFontFile *MapFontFile(const char *path) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat s;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &s) == 0 && (size_t)s.st_size >= sizeof(CompiledFontHeader)) {
+    base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  MappedFontFile *file = new MappedFontFile();
+  file->base = base;
+  file->size = s.st_size;
+  const CompiledFontHeader *header = (const CompiledFontHeader*) base;
+  if (memcmp(header->magic, kCompiledFontMagic, sizeof(header->magic)) != 0
+      || header->index_count % kGlyphsPerPage != 0
+      || (uint64_t)s.st_size != sizeof(CompiledFontHeader)
+      + sizeof(int32_t) * ((uint64_t)header->page_count + header->index_count)
+      + sizeof(CompiledGlyph) * (uint64_t)header->glyph_count
+      + header->bitmap_bytes) {
+    fprintf(stderr, "%s: not a compiled font file\n", path);
+    file->Unref();
+    return NULL;
+  }
+  file->header = header;
+  file->page_start = (const int32_t*) (header + 1);
+  file->glyph_index = file->page_start + header->page_count;
+  file->glyphs = (const CompiledGlyph*) (file->glyph_index
+                                         + header->index_count);
+  file->bitmaps = (const uint8_t*) (file->glyphs + header->glyph_count);
+  return file;
+}
+
+void Font::CreateOutlineGlyph(const Glyph &orig,
+                              Glyph *out, rowbitmap_t *out_rows) {
+  const int kBorder = kOutlineBorder;
+  const int height = orig.height + 2 * kBorder;
+  out->codepoint = orig.codepoint;
+  out->width  = orig.width  + 2*kBorder;
+  out->height = height;
+  out->device_width  = orig.device_width + 2*kBorder;
+  out->device_height = height;
+  out->x_offset = 0;
+  out->y_offset = orig.y_offset - kBorder;
+  out->bitmap = out_rows;
+  // TODO: we don't really need bounding box, right ?
+  const rowbitmap_t fill_pattern = 0b111;
+  const rowbitmap_t start_mask   = 0b010;
+  // Fill the border
+  for (int h = 0; h < orig.height; ++h) {
+    rowbitmap_t fill = fill_pattern;
+    rowbitmap_t orig_bitmap = orig.bitmap[h] >> kBorder;
+    for (rowbitmap_t m = start_mask; m; m <<= 1, fill <<= 1) {
+      if (orig_bitmap & m) {
+        out_rows[h+kBorder-1] |= fill;
+        out_rows[h+kBorder+0] |= fill;
+        out_rows[h+kBorder+1] |= fill;
+      }
+    }
+  }
+  // Remove original font again.
+  for (int h = 0; h < orig.height; ++h) {
+    rowbitmap_t orig_bitmap = orig.bitmap[h] >> kBorder;
+    out_rows[h+kBorder] &= ~orig_bitmap;
+  }
+}
+
+// Glyphs of a compiled font, decoded from the file when first used.
+struct Font::CompiledFont {
+  // Rows are allocated in chunks of this size, so that pointers to them
+  // stay valid.
+  static const int kChunkRows = 4096;
+
+  CompiledFont(MappedFontFile *f, int outlines)
+    : file(f), outline_level(outlines),
+      glyphs((Glyph*) calloc(f->header->glyph_count, sizeof(Glyph))),
+      chunk_pos(NULL), chunk_free(0) {}
+  ~CompiledFont() {
+    for (size_t i = 0; i < chunks.size(); ++i) delete [] chunks[i];
+    free(glyphs);
+    file->Unref();
+  }
+
+  const Glyph *FindGlyph(uint32_t codepoint) {
+    const CompiledFontHeader *header = file->header;
+    const uint32_t page = codepoint / kGlyphsPerPage;
+    if (page >= header->page_count) return NULL;
+    const int32_t page_start = file->page_start[page];
+    if (page_start < 0 ||
+        (uint32_t)page_start + kGlyphsPerPage > header->index_count)
+      return NULL;
+    const int32_t index
+      = file->glyph_index[page_start + codepoint % kGlyphsPerPage];
+    if (index < 0 || (uint32_t)index >= header->glyph_count) return NULL;
+    MutexLock l(&mutex);
+    Glyph *g = &glyphs[index];
+    if (g->bitmap == NULL && !Decode(file->glyphs[index], g))
+      return NULL;
+    return g;
+  }
+
+  bool Decode(const CompiledGlyph &c, Glyph *g) {
+    if (c.row_bytes > sizeof(rowbitmap_t) || c.height < 0 ||
+        (uint64_t)c.bitmap_offset + (uint64_t)c.row_bytes * c.height
+        > file->header->bitmap_bytes) {
+      fprintf(stderr, "Compiled font: invalid glyph for codepoint %u\n",
+              c.codepoint);
+      return false;
+    }
+    Glyph decoded;
+    decoded.codepoint = c.codepoint;
+    decoded.device_width = c.device_width;
+    decoded.device_height = c.device_height;
+    decoded.width = c.width;
+    decoded.height = c.height;
+    decoded.x_offset = c.x_offset;
+    decoded.y_offset = c.y_offset;
+    std::vector<rowbitmap_t> rows(c.height, 0);
+    const uint8_t *packed = file->bitmaps + c.bitmap_offset;
+    for (int y = 0; y < c.height; ++y) {
+      for (uint32_t b = 0; b < c.row_bytes; ++b) {
+        rows[y] |= (rowbitmap_t)*packed++ << (56 - 8 * b);
+      }
+    }
+    decoded.bitmap = rows.empty() ? NULL : &rows[0];
+    for (int i = 0; i < outline_level; ++i) {
+      std::vector<rowbitmap_t> outline_rows(decoded.height + 2*kOutlineBorder);
+      const Glyph orig = decoded;
+      CreateOutlineGlyph(orig, &decoded, &outline_rows[0]);
+      rows.swap(outline_rows);
+    }
+    *g = decoded;
+    rowbitmap_t *const bitmap = AllocateRows(rows.size());
+    std::copy(rows.begin(), rows.end(), bitmap);
+    g->bitmap = bitmap;
+    return true;
+  }
+
+  // Never returns NULL, so it can be used to mark a glyph decoded. This
+  // includes glyphs without rows, such as the space.
+  rowbitmap_t *AllocateRows(int count) {
+    if (count > chunk_free || chunk_pos == NULL) {
+      chunk_free = std::max(count, (int)kChunkRows);
+      chunk_pos = new rowbitmap_t[chunk_free];
+      chunks.push_back(chunk_pos);
+    }
+    rowbitmap_t *result = chunk_pos;
+    chunk_pos += count;
+    chunk_free -= count;
+    return result;
+  }
+
+  MappedFontFile *const file;
+  const int outline_level;  // Number of times CreateOutlineFont() applied.
+
+  Mutex mutex;
+  Glyph *const glyphs;  // Indexed like in file; bitmap NULL if not decoded.
+  std::vector<rowbitmap_t*> chunks;
+  rowbitmap_t *chunk_pos;
+  int chunk_free;
 };
 
-Font::Font() : font_height_(-1), base_line_(0) {}
+Font::Font()
+  : font_height_(-1), base_line_(0), replacement_glyph_(NULL),
+    compiled_(NULL), color_cache_(new ColorCache()) {}
 Font::~Font() {
-  for (CodepointGlyphMap::iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    free(it->second);
+  delete compiled_;
+  delete color_cache_;
+}
+
+void Font::IndexLastGlyph() {
+  const uint32_t codepoint = glyphs_.back().codepoint;
+  const size_t page = codepoint / kGlyphsPerPage;
+  if (page >= page_start_.size()) {
+    page_start_.resize(page + 1, -1);
+  }
+  if (page_start_[page] < 0) {
+    page_start_[page] = glyph_index_.size();
+    glyph_index_.resize(glyph_index_.size() + kGlyphsPerPage, -1);
   }
+  glyph_index_[page_start_[page] + codepoint % kGlyphsPerPage]
+    = glyphs_.size() - 1;
+}
+
+uint32_t Font::PageCount() const {
+  return compiled_ ? compiled_->file->header->page_count : page_start_.size();
 }
 
 // TODO: that might not be working for all input files yet.
 bool Font::LoadFont(const char *path) {
-  if (!path || !*path) return false;
+  if (!path || !*path || compiled_) return false;
   FILE *f = fopen(path, "r");
   if (f == NULL)
     return false;
   uint32_t codepoint;
   char buffer[1024];
   int dummy;
-  Glyph tmp;
-  Glyph *current_glyph = NULL;
+  Glyph current_glyph;
+  size_t bitmap_offset = 0;  // Of current glyph in bitmaps_.
+  bool in_glyph = false;
   int row = 0;
 
   int bitmap_shift = 0;
@@ -70,88 +335,200 @@ bool Font::LoadFont(const char *path) {
     else if (sscanf(buffer, "ENCODING %ud", &codepoint) == 1) {
       // parsed.
     }
-    else if (sscanf(buffer, "DWIDTH %d %d", &tmp.device_width, &tmp.device_height
-                    ) == 2) {
+    else if (sscanf(buffer, "DWIDTH %d %d", &current_glyph.device_width,
+                    &current_glyph.device_height) == 2) {
       // parsed.
     }
-    else if (sscanf(buffer, "BBX %d %d %d %d", &tmp.width, &tmp.height,
-                    &tmp.x_offset, &tmp.y_offset) == 4) {
-      current_glyph = (Glyph*) malloc(sizeof(Glyph)
-                                      + tmp.height * sizeof(rowbitmap_t));
-      *current_glyph = tmp;
+    else if (sscanf(buffer, "BBX %d %d %d %d", &current_glyph.width,
+                    &current_glyph.height, &current_glyph.x_offset,
+                    &current_glyph.y_offset) == 4) {
+      if (in_glyph) {  // Incomplete previous glyph. Discard.
+        bitmaps_.resize(bitmap_offset);
+      }
+      current_glyph.codepoint = codepoint;
+      bitmap_offset = bitmaps_.size();
+      bitmaps_.resize(bitmaps_.size() + current_glyph.height, 0);
+      in_glyph = true;
       // We only get number of bytes large enough holding our width. We want
       // it always left-aligned.
       bitmap_shift =
-        8 * (sizeof(rowbitmap_t) - ((current_glyph->width + 7) / 8))
-        - current_glyph->x_offset;
+        8 * (sizeof(rowbitmap_t) - ((current_glyph.width + 7) / 8))
+        - current_glyph.x_offset;
       row = -1;  // let's not start yet, wait for BITMAP
     }
     else if (strncmp(buffer, "BITMAP", strlen("BITMAP")) == 0) {
       row = 0;
     }
-    else if (current_glyph && row >= 0 && row < current_glyph->height
-             && (sscanf(buffer, "%" PRIx64, &current_glyph->bitmap[row]) == 1)) {
-      current_glyph->bitmap[row] <<= bitmap_shift;
+    else if (in_glyph && row >= 0 && row < current_glyph.height
+             && (sscanf(buffer, "%" PRIx64,
+                        &bitmaps_[bitmap_offset + row]) == 1)) {
+      bitmaps_[bitmap_offset + row] <<= bitmap_shift;
       row++;
     }
     else if (strncmp(buffer, "ENDCHAR", strlen("ENDCHAR")) == 0) {
-      if (current_glyph && row == current_glyph->height) {
-        free(glyphs_[codepoint]);  // just in case there was one.
-        glyphs_[codepoint] = current_glyph;
-        current_glyph = NULL;
+      if (in_glyph && row == current_glyph.height) {
+        glyphs_.push_back(current_glyph);
+        IndexLastGlyph();
+        in_glyph = false;
       }
     }
   }
   fclose(f);
+  if (in_glyph) bitmaps_.resize(bitmap_offset);
+
+  // Now that bitmaps_ doesn't change anymore, point glyphs to their rows.
+  // The rows are in the same sequence as the glyphs.
+  size_t offset = 0;
+  for (size_t i = 0; i < glyphs_.size(); ++i) {
+    glyphs_[i].bitmap = bitmaps_.empty() ? NULL : &bitmaps_[offset];
+    offset += glyphs_[i].height;
+  }
+  replacement_glyph_ = FindGlyph(kUnicodeReplacementCodepoint);
   return true;
 }
 
-Font *Font::CreateOutlineFont() const {
-  Font *r = new Font();
-  const int kBorder = 1;
-  r->font_height_ = font_height_ + 2*kBorder;
-  r->base_line_ = base_line_ + kBorder;
-  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    const Glyph *orig = it->second;
-    const int height = orig->height + 2 * kBorder;
-    const size_t alloc_size = sizeof(Glyph) + height * sizeof(rowbitmap_t);
-    Glyph *const tmp_glyph = (Glyph*) calloc(1, alloc_size);
-    tmp_glyph->width  = orig->width  + 2*kBorder;
-    tmp_glyph->height = height;
-    tmp_glyph->device_width  = orig->device_width + 2*kBorder;
-    tmp_glyph->device_height = height;
-    tmp_glyph->y_offset = orig->y_offset - kBorder;
-    // TODO: we don't really need bounding box, right ?
-    const rowbitmap_t fill_pattern = 0b111;
-    const rowbitmap_t start_mask   = 0b010;
-    // Fill the border
-    for (int h = 0; h < orig->height; ++h) {
-      rowbitmap_t fill = fill_pattern;
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
-      for (rowbitmap_t m = start_mask; m; m <<= 1, fill <<= 1) {
-        if (orig_bitmap & m) {
-          tmp_glyph->bitmap[h+kBorder-1] |= fill;
-          tmp_glyph->bitmap[h+kBorder+0] |= fill;
-          tmp_glyph->bitmap[h+kBorder+1] |= fill;
+bool Font::LoadCompiledFont(const char *path) {
+  if (!path || !*path || compiled_ || !glyphs_.empty()) return false;
+  MappedFontFile *file = MapFontFile(path);
+  if (file == NULL)
+    return false;
+  compiled_ = new CompiledFont(file, 0);
+  font_height_ = file->header->font_height;
+  base_line_ = file->header->base_line;
+  replacement_glyph_ = FindGlyph(kUnicodeReplacementCodepoint);
+  return true;
+}
+
+bool Font::WriteCompiledFont(const char *path) const {
+  CompiledFontHeader header;
+  memcpy(header.magic, kCompiledFontMagic, sizeof(header.magic));
+  header.font_height = font_height_;
+  header.base_line = base_line_;
+
+  std::vector<int32_t> page_start(PageCount(), -1);
+  std::vector<int32_t> glyph_index;
+  std::vector<CompiledGlyph> glyphs;
+  std::vector<uint8_t> bitmaps;
+  for (uint32_t page = 0; page < page_start.size(); ++page) {
+    for (int i = 0; i < kGlyphsPerPage; ++i) {
+      const uint32_t codepoint = page * kGlyphsPerPage + i;
+      const Glyph *g = FindGlyph(codepoint);
+      if (g == NULL) continue;
+      if (g->device_width != (int16_t)g->device_width ||
+          g->device_height != (int16_t)g->device_height ||
+          g->width != (int16_t)g->width || g->height != (int16_t)g->height ||
+          g->x_offset != (int16_t)g->x_offset ||
+          g->y_offset != (int16_t)g->y_offset) {
+        fprintf(stderr, "Glyph for codepoint %u too large\n", codepoint);
+        return false;
+      }
+      if (page_start[page] < 0) {
+        page_start[page] = glyph_index.size();
+        glyph_index.resize(glyph_index.size() + kGlyphsPerPage, -1);
+      }
+      glyph_index[page_start[page] + i] = glyphs.size();
+
+      CompiledGlyph c;
+      c.codepoint = codepoint;
+      c.device_width = g->device_width;
+      c.device_height = g->device_height;
+      c.width = g->width;
+      c.height = g->height;
+      c.x_offset = g->x_offset;
+      c.y_offset = g->y_offset;
+      c.bitmap_offset = bitmaps.size();
+      c.row_bytes = 0;
+      for (int y = 0; y < g->height; ++y) {
+        for (uint32_t b = c.row_bytes; b < sizeof(rowbitmap_t); ++b) {
+          if (g->bitmap[y] & ((rowbitmap_t)0xff << (56 - 8 * b)))
+            c.row_bytes = b + 1;
         }
       }
+      for (int y = 0; y < g->height; ++y) {
+        for (uint32_t b = 0; b < c.row_bytes; ++b) {
+          bitmaps.push_back((g->bitmap[y] >> (56 - 8 * b)) & 0xff);
+        }
+      }
+      glyphs.push_back(c);
     }
-    // Remove original font again.
-    for (int h = 0; h < orig->height; ++h) {
-      rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
-      tmp_glyph->bitmap[h+kBorder] &= ~orig_bitmap;
-    }
-    r->glyphs_[it->first] = tmp_glyph;
   }
+  header.page_count = page_start.size();
+  header.index_count = glyph_index.size();
+  header.glyph_count = glyphs.size();
+  header.bitmap_bytes = bitmaps.size();
+
+  FILE *out = fopen(path, "wb");
+  if (out == NULL) {
+    perror(path);
+    return false;
+  }
+  bool success = fwrite(&header, sizeof(header), 1, out) == 1;
+  if (!page_start.empty())
+    success &= fwrite(&page_start[0], sizeof(int32_t), page_start.size(), out)
+      == page_start.size();
+  if (!glyph_index.empty())
+    success &= fwrite(&glyph_index[0], sizeof(int32_t), glyph_index.size(),
+                      out) == glyph_index.size();
+  if (!glyphs.empty())
+    success &= fwrite(&glyphs[0], sizeof(CompiledGlyph), glyphs.size(), out)
+      == glyphs.size();
+  if (!bitmaps.empty())
+    success &= fwrite(&bitmaps[0], 1, bitmaps.size(), out) == bitmaps.size();
+  success &= (fclose(out) == 0);
+  if (!success) fprintf(stderr, "%s: failed to write font\n", path);
+  return success;
+}
+
+Font *Font::CreateOutlineFont() const {
+  Font *r = new Font();
+  r->font_height_ = font_height_ + 2*kOutlineBorder;
+  r->base_line_ = base_line_ + kOutlineBorder;
+  if (compiled_) {
+    // Outlines are created lazily when the glyph is first used.
+    compiled_->file->Ref();
+    r->compiled_ = new CompiledFont(compiled_->file,
+                                    compiled_->outline_level + 1);
+    r->replacement_glyph_ = r->FindGlyph(kUnicodeReplacementCodepoint);
+    return r;
+  }
+
+  // Only glyphs that are not replaced by a later one of the same codepoint.
+  std::vector<const Glyph*> originals;
+  size_t rows = 0;
+  for (size_t i = 0; i < glyphs_.size(); ++i) {
+    const Glyph *orig = &glyphs_[i];
+    if (FindGlyph(orig->codepoint) != orig)
+      continue;
+    originals.push_back(orig);
+    rows += orig->height + 2*kOutlineBorder;
+  }
+  r->glyphs_.reserve(originals.size());
+  r->bitmaps_.resize(rows, 0);  // Not resized anymore: pointers stay valid.
+  size_t offset = 0;
+  for (size_t i = 0; i < originals.size(); ++i) {
+    Glyph outline;
+    CreateOutlineGlyph(*originals[i], &outline, &r->bitmaps_[offset]);
+    offset += outline.height;
+    r->glyphs_.push_back(outline);
+    r->IndexLastGlyph();
+  }
+  r->replacement_glyph_ = r->FindGlyph(kUnicodeReplacementCodepoint);
   return r;
 }
 
 const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint) const {
-  CodepointGlyphMap::const_iterator found = glyphs_.find(unicode_codepoint);
-  if (found == glyphs_.end())
+  if (compiled_) return compiled_->FindGlyph(unicode_codepoint);
+  const size_t page = unicode_codepoint / kGlyphsPerPage;
+  if (page >= page_start_.size() || page_start_[page] < 0)
     return NULL;
-  return found->second;
+  const int32_t index
+    = glyph_index_[page_start_[page] + unicode_codepoint % kGlyphsPerPage];
+  return index < 0 ? NULL : &glyphs_[index];
+}
+
+const Font::Glyph *Font::FindGlyphOrReplacement(uint32_t codepoint) const {
+  const Glyph *g = FindGlyph(codepoint);
+  return g ? g : replacement_glyph_;
 }
 
 int Font::CharacterWidth(uint32_t unicode_codepoint) const {
@@ -159,15 +536,67 @@ int Font::CharacterWidth(uint32_t unicode_codepoint) const {
   return g ? g->device_width : -1;
 }
 
+template <class PreparingCanvas>
+int Font::DrawPreparedGlyph(PreparingCanvas *canvas, int x_pos, int y_pos,
+                            const Color &color, const Color *bgcolor,
+                            const Glyph *g) const {
+  const uint32_t foreground_rgb = (color.r << 16) | (color.g << 8) | color.b;
+  const uint32_t background_rgb = bgcolor
+    ? (bgcolor->r << 16) | (bgcolor->g << 8) | bgcolor->b
+    : ColorCache::kNoBackground;
+  const uint32_t settings = canvas->color_settings();
+  PreparedColor foreground, background;
+  {
+    MutexLock l(&color_cache_->mutex);
+    ColorCache *const cache = color_cache_;
+    ColorCache::Entry *entry = NULL;
+    for (int i = 0; i < ColorCache::kEntries; ++i) {
+      ColorCache::Entry *const e = &cache->entries[i];
+      if (e->foreground_rgb == foreground_rgb
+          && e->background_rgb == background_rgb
+          && e->foreground.color_settings == settings) {
+        entry = e;
+        break;
+      }
+    }
+    if (entry == NULL) {
+      entry = &cache->entries[cache->next_replaced];
+      cache->next_replaced = (cache->next_replaced + 1) % ColorCache::kEntries;
+      canvas->PrepareColor(color.r, color.g, color.b, &entry->foreground);
+      if (bgcolor) {
+        canvas->PrepareColor(bgcolor->r, bgcolor->g, bgcolor->b,
+                             &entry->background);
+      }
+      entry->foreground_rgb = foreground_rgb;
+      entry->background_rgb = background_rgb;
+    }
+    foreground = entry->foreground;
+    background = entry->background;
+  }
+  canvas->DrawBitmap(x_pos, y_pos - g->height - g->y_offset,
+                     g->device_width, g->height, g->bitmap,
+                     foreground, bgcolor ? &background : NULL);
+  return g->device_width;
+}
+
 int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
                     const Color &color, const Color *bgcolor,
                     uint32_t unicode_codepoint) const {
-  const Glyph *g = FindGlyph(unicode_codepoint);
-  if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
+  const Glyph *g = FindGlyphOrReplacement(unicode_codepoint);
   if (g == NULL) return 0;
+
+  // Fast path: prepared colors, whole glyph at once.
+  if (FrameCanvas *frame_canvas = dynamic_cast<FrameCanvas*>(c)) {
+    return DrawPreparedGlyph(frame_canvas, x_pos, y_pos, color, bgcolor, g);
+  }
+  if (RGBMatrix *matrix = dynamic_cast<RGBMatrix*>(c)) {
+    return DrawPreparedGlyph(matrix, x_pos, y_pos, color, bgcolor, g);
+  }
+
+  const rowbitmap_t *bitmap = g->bitmap;
   y_pos = y_pos - g->height - g->y_offset;
   for (int y = 0; y < g->height; ++y) {
-    const rowbitmap_t row = g->bitmap[y];
+    const rowbitmap_t row = bitmap[y];
     rowbitmap_t x_mask = (1LL<<63);
     for (int x = 0; x < g->device_width; ++x, x_mask >>= 1) {
       if (row & x_mask) {
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "hardware-mapping.h"
 
 namespace rgb_matrix {
@@ -26,6 +28,34 @@ class PinPulser;
 namespace internal {
 class RowAddressSetter;
 
+enum {
+  kBitPlanes = 11  // maximum usable bitplanes.
+};
+
+// Type of the words in the bitplane buffer. By default, these are the bits
+// written to the GPIO pins. With BITPLANE_WORD_BITS=8 or 16, the color bits
+// of up to one or two parallel chains are packed into smaller words instead,
+// which are expanded to GPIO bits while clocking out. Then, only the
+// bitplanes of the configured pwm bits are stored, too.
+#ifndef BITPLANE_WORD_BITS
+#  define BITPLANE_WORD_BITS 32
+#endif
+#if BITPLANE_WORD_BITS == 8
+typedef uint8_t plane_bits_t;
+#elif BITPLANE_WORD_BITS == 16
+typedef uint16_t plane_bits_t;
+#elif BITPLANE_WORD_BITS == 32
+typedef gpio_bits_t plane_bits_t;
+#else
+#  error "BITPLANE_WORD_BITS needs to be one of 8, 16 or 32"
+#endif
+
+// A color prepared for a particular Framebuffer: for each bitplane the color
+// channels that are switched on; bit 0: red, bit 1: green, bit 2: blue.
+struct PlaneColor {
+  uint8_t plane[kBitPlanes];
+};
+
 // An opaque type used within the framebuffer that can be used
 // to copy between PixelMappers.
 struct PixelDesignator {
@@ -37,6 +67,22 @@ struct PixelDesignator {
   uint32_t mask;
 };
 
+// A run of horizontally adjacent pixels in a row of the PixelDesignatorMap.
+// Within a run, the gpio_word advances by a constant "stride" from pixel to
+// pixel and all pixels share the same color bits. So bulk writers can
+// process a whole run in a tight loop without looking at each individual
+// PixelDesignator.
+struct PixelDesignatorRun {
+  int x;          // Start position in the row.
+  int length;     // Number of pixels.
+  int gpio_word;  // gpio_word of the first pixel. Negative: unused pixels.
+  int stride;     // Difference of gpio_word between neighboring pixels.
+  uint32_t r_bit;
+  uint32_t g_bit;
+  uint32_t b_bit;
+  uint32_t mask;
+};
+
 class PixelDesignatorMap {
 public:
   PixelDesignatorMap(int width, int height, const PixelDesignator &fill_bits);
@@ -45,18 +91,57 @@ public:
   // Get a writable version of the PixelDesignator. Outside Framebuffer used
   // by the RGBMatrix to re-assign mappings to new PixelDesignatorMappers.
   PixelDesignator *get(int x, int y);
+  const PixelDesignator *get(int x, int y) const;
 
   inline int width() const { return width_; }
   inline int height() const { return height_; }
 
   // All bits that set red/green/blue pixels; used for Fill().
-  const PixelDesignator &GetFillColorBits() { return fill_bits_; }
+  const PixelDesignator &GetFillColorBits() const { return fill_bits_; }
+
+  // Analyze the PixelDesignators into runs. This needs to be called once
+  // the mapping is final; modifications via get() later are not reflected.
+  void CompileRuns();
+
+  // Get the runs of row "y", sorted by x, covering the full width. The
+  // number of runs is returned in "count". Only valid after CompileRuns().
+  const PixelDesignatorRun *GetRuns(int y, int *count) const {
+    *count = row_start_[y + 1] - row_start_[y];
+    return &runs_[row_start_[y]];
+  }
+
+  struct RunStatistics {
+    int pixels;         // Total number of pixels in the map.
+    int unused_pixels;  // Pixels not mapped to anything.
+    int runs;           // Runs of used pixels.
+    int longest_run;
+  };
+  RunStatistics GetRunStatistics() const;
+
+  // Store the map in a file, tagged with the "key" describing the
+  // configuration it was created with. Returns 'true' on success.
+  bool SaveToFile(const char *filename, const char *key) const;
+
+  // Load a map previously stored with SaveToFile(). Returns NULL if the file
+  // can not be read or was stored with a different "key"; also if it does
+  // not fit the "physical" map set up by the first Framebuffer, with
+  // "double_rows" rows of "planes" bitplanes: every pixel has to point to a
+  // column of a double row and only use its color bits, and the map can't
+  // be much larger than the physical one.
+  // Runs are already compiled on the returned map.
+  static PixelDesignatorMap *LoadFromFile(const char *filename,
+                                          const char *key,
+                                          const PixelDesignatorMap &physical,
+                                          int double_rows, int planes);
 
 private:
   const int width_;
   const int height_;
   const PixelDesignator fill_bits_;  // Precalculated for fill.
   PixelDesignator *const buffer_;
+
+  std::vector<PixelDesignatorRun> runs_;
+  std::vector<int> row_start_;       // Index into runs_; height_+1 elements.
 };
 
 // Internal representation of the frame-buffer that as well can
@@ -65,10 +150,14 @@ private:
 // written out.
 class Framebuffer {
 public:
-  Framebuffer(int rows, int columns, int parallel,
+  // Only bitplanes kBitPlanes - "planes" .. kBitPlanes - 1 are stored; all
+  // Framebuffers sharing a "mapper" need to have the same number.
+  // With "huge_pages", the bitplane buffer is allocated in huge pages if
+  // the system provides them.
+  Framebuffer(int rows, int columns, int parallel, int planes,
               int scan_mode,
               const char* led_sequence, bool inverse_color,
-              PixelDesignatorMap **mapper);
+              bool huge_pages, PixelDesignatorMap **mapper);
   ~Framebuffer();
 
   // Initialize GPIO bits for output. Only call once.
@@ -77,15 +166,29 @@ public:
                        bool allow_hardware_pulsing,
                        int pwm_lsb_nanoseconds,
                        int dither_bits,
-                       int row_address_type);
+                       int row_address_type,
+                       bool performance_governor = true,
+                       bool scalable_pulses = false);
   static void InitializePanels(GPIO *io, const char *panel_type, int columns);
 
+  // Bitplanes to store for the given pwm bits. That is all of them, unless
+  // compiled with compact BITPLANE_WORD_BITS.
+  static int StoredPlanes(int pwm_bits);
+
+  // Number of plane_bits_t in the bitplane buffer for the given geometry.
+  static int BufferElements(int rows, int columns, int planes);
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
   // Returns boolean to signify if value was within range.
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits() { return pwm_bits_; }
 
+  // Set PWM bits for the double rows showing rows "y" .. "y + height - 1".
+  // Lower planes of these are skipped in output, shortening the refresh.
+  // Never more than pwmbits() are shown. Returns false if value is invalid.
+  bool SetRowPWMBits(int y, int height, uint8_t value);
+
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
   bool luminance_correct() const { return do_luminance_correct_; }
@@ -97,7 +200,68 @@ public:
   }
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  // Dim the whole output by shortening the output enable pulses to the
+  // given percent. With "luminance_correct", the percent is mapped like
+  // with SetBrightness(). Other than that, this doesn't change any content:
+  // it takes effect with the next refresh and keeps all color depth.
+  // Pulses are only shortened as far as they stay in proportion; returns
+  // the brightness to map colors with for the rest of the dimming, 100 if
+  // none is needed.
+  static uint8_t SetPulseBrightness(uint8_t percent, bool luminance_correct);
+
+  // -- Dithering. With fewer than kBitPlanes pwm bits, the levels in between
+  // the ones that can be shown are approximated by adding a threshold that
+  // depends on the pixel position before the lower bitplanes are dropped.
+  // Applies to newly set pixels, but not to prepared or palette colors.
+  enum { kDitherNone = 0, kDitherOrdered = 1, kDitherBlueNoise = 2 };
+  // Returns boolean to signify if mode was valid.
+  bool SetDither(int mode);
+  int dither() const { return dither_mode_; }
+  // Shift of the thresholds. Changing it for every frame spreads the
+  // dithering over time as well.
+  void SetDitherPhase(unsigned phase) { dither_phase_ = phase; }
+
+  // Output to the matrix. Bitplanes with their bit set in "fade_planes"
+  // are taken from "fade_to" instead; see RGBMatrix::CrossFade().
+  // If "overlay" is given, its pixels in its overlay mask are shown on top.
+  void DumpToMatrix(GPIO *io, int pwm_bits_to_show,
+                    const Framebuffer *fade_to = NULL,
+                    uint32_t fade_planes = 0,
+                    const Framebuffer *overlay = NULL);
+
+  // True if the output is known to be dark: none of the shown bitplanes has
+  // any bit set. Never true with inverted colors, where that is white.
+  // Conservative: the planes of a row are only known to be empty after
+  // Clear() or Fill(), so black drawn over content isn't detected.
+  bool IsBlank() const;
+
+  // -- Use as overlay: the mask determines which pixels are shown on top
+  // of other frames in DumpToMatrix(). Initially, no pixel is.
+  // Mark the rectangle as shown or transparent.
+  void SetOverlayMask(int x, int y, int width, int height, bool visible);
+  // Show all pixels that are not black, all black ones are transparent.
+  void SetOverlayMaskFromContent();
+  // Make sure the mask exists. Needs to be called before this is handed
+  // to DumpToMatrix() as overlay, as the mask is read from the refresh
+  // thread without locking and must not be re-allocated then.
+  void AllocateOverlayMask();
+
+  // Create a new bitplane buffer with the content of this one re-arranged
+  // from mapping "from" to mapping "to": pixels keep their logical (x,y)
+  // position if it exists in both mappings; others are switched off.
+  // Ownership of the returned buffer is passed to the caller, typically
+  // to be installed with ReplaceBitplaneBuffer().
+  plane_bits_t *CreateRemappedBuffer(const PixelDesignatorMap &from,
+                                     const PixelDesignatorMap &to) const;
+
+  // Replace the bitplane buffer with one created by CreateRemappedBuffer().
+  // The overlay mask and SetRowPWMBits() settings are reset.
+  // Returns the previous buffer, to be freed with FreeBitplaneBuffer().
+  plane_bits_t *ReplaceBitplaneBuffer(plane_bits_t *buffer);
+
+  // Free a buffer returned by CreateRemappedBuffer() or
+  // ReplaceBitplaneBuffer().
+  void FreeBitplaneBuffer(plane_bits_t *buffer) const;
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
@@ -108,9 +272,79 @@ public:
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  // Set pixel with a color prepared with PrepareColor().
+  void SetPixel(int x, int y, const PlaneColor &color);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
+  // Set "width" pixels starting at "x","y" in horizontal direction to the
+  // given color. Makes use of the runs in the PixelDesignatorMap, so the
+  // color conversion only happens once for the whole span.
+  void FillSpan(int x, int y, int width,
+                uint8_t red, uint8_t green, uint8_t blue);
+
+  // Set "width" pixels starting at "x","y" in horizontal direction to the
+  // colors in "rgb" (three bytes per pixel). Walks the runs of the
+  // PixelDesignatorMap instead of looking up each pixel.
+  void SetRow(int x, int y, int width, const uint8_t *rgb);
+
+  // Partition the rows into groups that don't share any bitplane words, so
+  // that rows of different groups can be written concurrently, e.g. with
+  // SetRow(). Sets the group of each row in "group_of_row" (-1 for rows
+  // not connected to the matrix) and returns the number of groups.
+  int GetRowGroups(std::vector<int> *group_of_row) const;
+
+  // -- Reading back content from the bitplanes.
+  // Get the brightness levels of the pixel at "x","y" as they are shown,
+  // each in the range [0, 1 << kBitPlanes), with the planes not shown due
+  // to pwm bits being zero. Returns 'false' if there is no such pixel.
+  bool GetPixelLevels(int x, int y,
+                      uint16_t *red, uint16_t *green, uint16_t *blue) const;
+  // Get the color of the pixel at "x","y". This inverts the mapping done
+  // when the pixel was set, using the current brightness and luminance
+  // settings. If several colors map to the same levels, the smallest of them
+  // is returned. Returns 'false' and black if there is no such pixel.
+  bool GetPixel(int x, int y, uint8_t *red, uint8_t *green, uint8_t *blue);
+  // Get the colors of the "width" x "height" rectangle at "x","y" into
+  // "rgb" with three bytes per pixel, row by row.
+  void GetImage(int x, int y, int width, int height, uint8_t *rgb);
+
+  // Copy the rectangle at "x","y" with the given size to "dst_x","dst_y".
+  // Source and destination may overlap. Works on the bitplanes directly, so
+  // no color conversion is involved.
+  void CopyRegion(int x, int y, int width, int height, int dst_x, int dst_y);
+
+  // Move the content of the rectangle at "x","y" with the given size by
+  // "dx","dy". Pixels moved in from outside the rectangle get the given color.
+  void ScrollRegion(int x, int y, int width, int height, int dx, int dy,
+                    uint8_t red, uint8_t green, uint8_t blue);
+
+  // Prepare a color to be used in DrawBitmap(). The result is only valid
+  // as long as color_settings() doesn't change.
+  void PrepareColor(uint8_t red, uint8_t green, uint8_t blue,
+                    PlaneColor *color);
+  // Value representing all settings that influence PrepareColor().
+  uint32_t color_settings() const;
+
+  // -- Indexed colors: a palette of kPaletteSize colors, that can be used
+  // to write pixels by index. Entries are black until set.
+  enum { kPaletteSize = 256 };
+  // Set palette entry. If "recolor" is set and the entry was set before,
+  // all pixels that currently have the previous color of that entry are
+  // changed to the new color.
+  void SetPaletteColor(uint8_t index, uint8_t red, uint8_t green, uint8_t blue,
+                       bool recolor);
+  // Set "width" pixels starting at "x","y" in horizontal direction to the
+  // palette entries given in "indices".
+  void SetIndexedRow(int x, int y, int width, const uint8_t *indices);
+
+  // Draw "height" rows of a one-bit bitmap at "x","y". Bit 63 of each row is
+  // the left-most pixel; up to "width" (max 64) pixels are drawn. Set bits
+  // are drawn in "foreground", others in "background" or left untouched if
+  // that is NULL.
+  void DrawBitmap(int x, int y, int width, int height, const uint64_t *rows,
+                  const PlaneColor &foreground, const PlaneColor *background);
+
 private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
@@ -126,6 +360,44 @@ private:
                              PixelDesignator *designator);
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+  // MapColors() in two steps: levels with luminance correction and
+  // brightness, then adding the "dither" offset and inversion.
+  inline void  MapLevels(uint8_t r, uint8_t g, uint8_t b,
+                         uint16_t *red, uint16_t *green, uint16_t *blue);
+  inline void  FinishLevels(uint16_t dither,
+                            uint16_t *red, uint16_t *green, uint16_t *blue);
+
+  // Thresholds for row "y" of the dither pattern; NULL if not dithering.
+  const uint8_t *DitherRow(int y) const;
+  // Offset to add to the levels of pixel "x" in a row from DitherRow().
+  inline uint16_t DitherOffset(const uint8_t *dither_row, int x) const;
+  // If levels are not exactly representable with the pwm bits shown.
+  inline bool NeedsDither(uint16_t red, uint16_t green, uint16_t blue) const;
+
+  // Make sure palette_ is prepared for the current color_settings().
+  void UpdatePalette();
+
+  // Make sure level_to_color_ is prepared for the current settings.
+  void UpdateLevelToColor();
+  // Levels of a pixel described by given bits, starting at the first plane.
+  inline void ReadLevels(const plane_bits_t *bits,
+                         plane_bits_t r_bit, plane_bits_t g_bit,
+                         plane_bits_t b_bit,
+                         uint16_t *red, uint16_t *green, uint16_t *blue) const;
+
+  // Part of a row in which neither the source nor the destination run
+  // changes; used in CopyRow().
+  struct CopySegment {
+    int offset;  // From start of the copied pixels.
+    int count;
+    const PixelDesignatorRun *src;
+    const PixelDesignatorRun *dst;
+  };
+  void CopyRow(int src_x, int src_y, int dst_x, int dst_y, int width);
+  // If each row of the mapping is just one run of consecutive gpio words,
+  // a column of gpio words contains exactly one column of the canvas.
+  bool HasLinearRows() const;
+
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
@@ -133,12 +405,18 @@ private:
 
   const int scan_mode_;
   const bool inverse_color_;
+  const bool huge_pages_;
 
   uint8_t pwm_bits_;   // PWM bits to display.
+  std::vector<uint8_t> row_pwm_bits_;  // Per double row.
   bool do_luminance_correct_;
   uint8_t brightness_;
+  int dither_mode_;
+  unsigned dither_phase_;
 
   const int double_rows_;
+  const int first_plane_;  // Lowest stored bitplane.
+  const int row_words_;    // Words per double row: a row for each plane.
   const size_t buffer_size_;
 
   // The frame-buffer is organized in bitplanes.
@@ -147,10 +425,40 @@ private:
   // Each bitplane-column is pre-filled IoBits, of which the colors are set.
   // Of course, that means that we store unrelated bits in the frame-buffer,
   // but it allows easy access in the critical section.
-  gpio_bits_t *bitplane_buffer_;
-  inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
+  plane_bits_t *bitplane_buffer_;
+  inline plane_bits_t *ValueAt(int double_row, int column, int bit);
+  // Offset of "bit" plane from the first stored one.
+  int PlaneOffset(int bit) const { return (bit - first_plane_) * columns_; }
+
+  // For each double row a bit for each bitplane that might contain set bits.
+  // Planes without are not clocked out in DumpToMatrix(). Writers add the
+  // planes of the levels they write; only Clear() and Fill() reset them.
+  std::vector<uint16_t> nonzero_planes_;
+  // Add "planes" to the double rows of "count" gpio words from "gpio_word".
+  inline void MarkPlanes(int gpio_word, int count, int stride,
+                         uint16_t planes);
+  // Planes of all double rows showing pixels of row "y"; and marking these.
+  uint16_t RowPlanes(int y) const;
+  void MarkRowPlanes(int y, uint16_t planes);
 
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
+  std::vector<CopySegment> copy_segments_;  // Scratch space for CopyRow().
+
+  // For use as overlay: for each gpio word of a bitplane, the color bits
+  // of the pixels to show. Empty until allocated with AllocateOverlayMask().
+  std::vector<plane_bits_t> overlay_mask_;
+  inline plane_bits_t *OverlayMaskAt(int gpio_word);
+
+  // Palette colors. Both empty until the first palette entry is set.
+  std::vector<uint8_t> palette_rgb_;    // Three bytes per entry.
+  std::vector<PlaneColor> palette_;     // Prepared for palette_settings_.
+  std::vector<bool> palette_set_;       // Entries set with SetPaletteColor().
+  uint32_t palette_settings_;
+
+  // Inverse of the color mapping for reading back pixels: a color for each
+  // level. Prepared for level_to_color_settings_ and the pwm bits.
+  std::vector<uint8_t> level_to_color_;
+  uint32_t level_to_color_settings_;
 };
 }  // namespace internal
 }  // namespace rgb_matrix
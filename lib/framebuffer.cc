@@ -26,20 +26,84 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <string>
 
 #include "gpio.h"
 
 namespace rgb_matrix {
 namespace internal {
-enum {
-  kBitPlanes = 11  // maximum usable bitplanes.
-};
-
 // We need one global instance of a timing correct pulser. There are different
 // implementations depending on the context.
 static PinPulser *sOutputEnablePulser = NULL;
+// Pulse scale applied to the sOutputEnablePulser, also once it is created.
+static int sPulseScale = PinPulser::kFullPulseScale;
+// If the panel shift registers only contain zeros from the last clocking.
+static bool sShiftRegistersZero = false;
+
+static const uint16_t kAllPlanes = (1 << kBitPlanes) - 1;
+
+// Bitplanes in which a PlaneColor has any channel set.
+static uint16_t PlaneMask(const PlaneColor &color) {
+  uint16_t result = 0;
+  for (int b = 0; b < kBitPlanes; ++b) {
+    if (color.plane[b]) result |= (1 << b);
+  }
+  return result;
+}
+
+#if BITPLANE_WORD_BITS < 32
+// The GPIO bit of each color bit packed into a plane_bits_t, and for each
+// byte of a plane_bits_t the GPIO bits it expands to.
+static gpio_bits_t sPackedColorGpio[BITPLANE_WORD_BITS];
+static gpio_bits_t sExpandByte[BITPLANE_WORD_BITS / 8][256];
+
+static void InitColorPacking(const struct HardwareMapping &h) {
+  const gpio_bits_t colors[] = {
+    h.p0_r1, h.p0_g1, h.p0_b1, h.p0_r2, h.p0_g2, h.p0_b2,
+    h.p1_r1, h.p1_g1, h.p1_b1, h.p1_r2, h.p1_g2, h.p1_b2,
+    h.p2_r1, h.p2_g1, h.p2_b1, h.p2_r2, h.p2_g2, h.p2_b2,
+  };
+  const int color_count = sizeof(colors) / sizeof(colors[0]);
+  for (int i = 0; i < BITPLANE_WORD_BITS; ++i) {
+    sPackedColorGpio[i] = (i < color_count) ? colors[i] : 0;
+  }
+  for (int byte = 0; byte < BITPLANE_WORD_BITS / 8; ++byte) {
+    for (int value = 0; value < 256; ++value) {
+      gpio_bits_t expanded = 0;
+      for (int b = 0; b < 8; ++b) {
+        if (value & (1 << b)) expanded |= sPackedColorGpio[8 * byte + b];
+      }
+      sExpandByte[byte][value] = expanded;
+    }
+  }
+}
+
+// The color bits of the given GPIO bits in their packed position.
+static plane_bits_t PackColorBits(gpio_bits_t bits) {
+  plane_bits_t result = 0;
+  for (int i = 0; i < BITPLANE_WORD_BITS; ++i) {
+    if (bits & sPackedColorGpio[i]) result |= (1 << i);
+  }
+  return result;
+}
+
+static inline gpio_bits_t ExpandColorBits(plane_bits_t bits) {
+#if BITPLANE_WORD_BITS == 8
+  return sExpandByte[0][bits];
+#else
+  return sExpandByte[0][bits & 0xff] | sExpandByte[1][bits >> 8];
+#endif
+}
+#else
+// Bitplane words are GPIO bits already.
+static inline void InitColorPacking(const struct HardwareMapping &h) {}
+static inline plane_bits_t PackColorBits(gpio_bits_t bits) { return bits; }
+static inline gpio_bits_t ExpandColorBits(plane_bits_t bits) { return bits; }
+#endif
 
 #ifdef ONLY_SINGLE_SUB_PANEL
 #  define SUB_PANELS_ 1
@@ -53,6 +117,12 @@ PixelDesignator *PixelDesignatorMap::get(int x, int y) {
   return buffer_ + (y*width_) + x;
 }
 
+const PixelDesignator *PixelDesignatorMap::get(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_)
+    return NULL;
+  return buffer_ + (y*width_) + x;
+}
+
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
                                        const PixelDesignator &fill_bits)
   : width_(width), height_(height), fill_bits_(fill_bits),
@@ -63,6 +133,163 @@ PixelDesignatorMap::~PixelDesignatorMap() {
   delete [] buffer_;
 }
 
+static bool SameColorBits(const PixelDesignatorRun &run,
+                          const PixelDesignator &d) {
+  return (run.r_bit == d.r_bit && run.g_bit == d.g_bit && run.b_bit == d.b_bit
+          && run.mask == d.mask);
+}
+
+void PixelDesignatorMap::CompileRuns() {
+  runs_.clear();
+  row_start_.clear();
+  for (int y = 0; y < height_; ++y) {
+    row_start_.push_back(runs_.size());
+    const PixelDesignator *d = buffer_ + y * width_;
+    for (int x = 0; x < width_; ++x, ++d) {
+      if (x > 0) {
+        PixelDesignatorRun &run = runs_.back();
+        if (run.gpio_word < 0 && d->gpio_word < 0) {
+          run.length++;   // Unused pixels are collected regardless of bits.
+          continue;
+        }
+        if (run.gpio_word >= 0 && d->gpio_word >= 0 && SameColorBits(run, *d)) {
+          const int stride = d->gpio_word - (d-1)->gpio_word;
+          if (run.length == 1 && stride != 0) {
+            run.stride = stride;
+          }
+          if (stride != 0 && stride == run.stride) {
+            run.length++;
+            continue;
+          }
+        }
+      }
+      PixelDesignatorRun run;
+      run.x = x;
+      run.length = 1;
+      run.gpio_word = d->gpio_word < 0 ? -1 : d->gpio_word;
+      run.stride = 1;
+      run.r_bit = d->r_bit;
+      run.g_bit = d->g_bit;
+      run.b_bit = d->b_bit;
+      run.mask = d->mask;
+      runs_.push_back(run);
+    }
+  }
+  row_start_.push_back(runs_.size());
+}
+
+PixelDesignatorMap::RunStatistics PixelDesignatorMap::GetRunStatistics() const {
+  RunStatistics stats = { width_ * height_, 0, 0, 0 };
+  for (size_t i = 0; i < runs_.size(); ++i) {
+    const PixelDesignatorRun &run = runs_[i];
+    if (run.gpio_word < 0) {
+      stats.unused_pixels += run.length;
+      continue;
+    }
+    stats.runs++;
+    stats.longest_run = std::max(stats.longest_run, run.length);
+  }
+  return stats;
+}
+
+// Header of the file written by PixelDesignatorMap::SaveToFile(). The file
+// is in the native representation of the machine it is used on; it is
+// merely a cache and not meant to be moved around.
+static const uint32_t kMapFileMagic = 0x50444D31;   // "PDM1"
+struct MapFileHeader {
+  uint32_t magic;
+  uint32_t designator_size;  // sizeof(PixelDesignator)
+  int32_t width;
+  int32_t height;
+  uint32_t key_len;
+  // Followed by the key, fill bits and width*height PixelDesignators.
+};
+
+bool PixelDesignatorMap::SaveToFile(const char *filename,
+                                    const char *key) const {
+  // Write to a temporary file first, so that concurrent readers never see a
+  // half-written map.
+  const std::string tmp_file = std::string(filename) + ".tmp";
+  FILE *f = fopen(tmp_file.c_str(), "wb");
+  if (f == NULL) return false;
+  MapFileHeader header;
+  header.magic = kMapFileMagic;
+  header.designator_size = sizeof(PixelDesignator);
+  header.width = width_;
+  header.height = height_;
+  header.key_len = strlen(key);
+  const size_t pixels = width_ * height_;
+  bool success = (fwrite(&header, sizeof(header), 1, f) == 1
+                  && fwrite(key, 1, header.key_len, f) == header.key_len
+                  && fwrite(&fill_bits_, sizeof(fill_bits_), 1, f) == 1
+                  && fwrite(buffer_, sizeof(*buffer_), pixels, f) == pixels);
+  success &= (fclose(f) == 0);
+  if (success) success = (rename(tmp_file.c_str(), filename) == 0);
+  if (!success) unlink(tmp_file.c_str());
+  return success;
+}
+
+// Pixel mappers re-arrange the physical pixels, possibly leaving parts of the
+// canvas unused. A map larger than this factor is not from a valid mapping.
+static const size_t kMaxMapSizeFactor = 4;
+
+// If "d" writes only the color bits and columns of a bitplane buffer with
+// the given geometry, so that writers can't go past its end.
+static bool IsValidDesignator(const PixelDesignator &d,
+                              plane_bits_t color_bits, int columns,
+                              int double_rows, int row_words) {
+  if (d.gpio_word < 0) return true;  // Not connected.
+  return (d.gpio_word % row_words < columns
+          && d.gpio_word / row_words < double_rows
+          && ((d.r_bit | d.g_bit | d.b_bit) & ~color_bits) == 0);
+}
+
+PixelDesignatorMap *PixelDesignatorMap::LoadFromFile(
+  const char *filename, const char *key,
+  const PixelDesignatorMap &physical, int double_rows, int planes) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) return NULL;
+  PixelDesignatorMap *result = NULL;
+  MapFileHeader header;
+  std::string file_key;
+  PixelDesignator fill_bits;
+  if (fread(&header, sizeof(header), 1, f) == 1
+      && header.magic == kMapFileMagic
+      && header.designator_size == sizeof(PixelDesignator)
+      && header.width > 0 && header.height > 0
+      && (size_t)header.width * header.height
+         <= kMaxMapSizeFactor * physical.width() * physical.height()
+      && header.key_len == strlen(key)) {
+    const PixelDesignator &physical_fill = physical.GetFillColorBits();
+    const plane_bits_t color_bits = (physical_fill.r_bit | physical_fill.g_bit
+                                     | physical_fill.b_bit);
+    const int columns = physical.width();
+    file_key.resize(header.key_len);
+    if (fread(&file_key[0], 1, header.key_len, f) == header.key_len
+        && file_key == key
+        && fread(&fill_bits, sizeof(fill_bits), 1, f) == 1
+        && fill_bits.r_bit == physical_fill.r_bit
+        && fill_bits.g_bit == physical_fill.g_bit
+        && fill_bits.b_bit == physical_fill.b_bit) {
+      result = new PixelDesignatorMap(header.width, header.height, fill_bits);
+      const size_t pixels = (size_t)header.width * header.height;
+      bool valid = fread(result->buffer_, sizeof(PixelDesignator), pixels, f)
+        == pixels;
+      for (size_t i = 0; valid && i < pixels; ++i) {
+        valid = IsValidDesignator(result->buffer_[i], color_bits, columns,
+                                  double_rows, columns * planes);
+      }
+      if (!valid) {
+        delete result;
+        result = NULL;
+      }
+    }
+  }
+  fclose(f);
+  if (result) result->CompileRuns();
+  return result;
+}
+
 // Different panel types use different techniques to set the row address.
 // We abstract that away with different implementations of RowAddressSetter
 class RowAddressSetter {
@@ -230,20 +457,95 @@ private:
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
 
-Framebuffer::Framebuffer(int rows, int columns, int parallel,
+// Size of huge pages as reported by the kernel; 2MB if we can't tell.
+static size_t HugePageSize() {
+  static size_t page_size = 0;
+  if (page_size) return page_size;
+  page_size = 2 << 20;
+  FILE *meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo == NULL) return page_size;
+  char line[128];
+  unsigned long kbytes;
+  while (fgets(line, sizeof(line), meminfo)) {
+    if (sscanf(line, "Hugepagesize: %lu kB", &kbytes) == 1 && kbytes > 0) {
+      page_size = kbytes << 10;
+      break;
+    }
+  }
+  fclose(meminfo);
+  return page_size;
+}
+
+static size_t HugePageRoundUp(size_t bytes) {
+  const size_t page_size = HugePageSize();
+  return (bytes + page_size - 1) / page_size * page_size;
+}
+
+// Allocate a bitplane buffer of "bytes" starting on a cache line, or, with
+// "huge_pages", in huge pages to save TLB misses while refreshing large
+// displays. Either way, all pages are touched right away so that
+// the refresh thread never takes a page fault on first access.
+static plane_bits_t *AllocateBitplaneBuffer(size_t bytes, bool huge_pages) {
+  void *result = NULL;
+  if (huge_pages) {
+    const size_t len = HugePageRoundUp(bytes);
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+    result = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                  -1, 0);
+#else
+    result = MAP_FAILED;
+#endif
+    if (result == MAP_FAILED) {
+      // No reserved huge pages (vm.nr_hugepages). Ask for transparent
+      // huge pages instead, which the kernel might or might not give us.
+      result = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (result == MAP_FAILED) {
+        perror("mmap() bitplane buffer");
+        abort();
+      }
+#ifdef MADV_HUGEPAGE
+      madvise(result, len, MADV_HUGEPAGE);
+#endif
+    }
+  } else {
+    if (posix_memalign(&result, 64, bytes) != 0) {
+      fprintf(stderr, "Can't allocate %zu bytes bitplane buffer.\n", bytes);
+      abort();
+    }
+  }
+  memset(result, 0, bytes);
+  return (plane_bits_t*) result;
+}
+
+static void ReleaseBitplaneBuffer(plane_bits_t *buffer, size_t bytes,
+                                  bool huge_pages) {
+  if (huge_pages) {
+    munmap(buffer, HugePageRoundUp(bytes));
+  } else {
+    free(buffer);
+  }
+}
+
+Framebuffer::Framebuffer(int rows, int columns, int parallel, int planes,
                          int scan_mode,
                          const char *led_sequence, bool inverse_color,
-                         PixelDesignatorMap **mapper)
+                         bool huge_pages, PixelDesignatorMap **mapper)
   : rows_(rows),
     parallel_(parallel),
     height_(rows * parallel),
     columns_(columns),
     scan_mode_(scan_mode),
-    inverse_color_(inverse_color),
-    pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    inverse_color_(inverse_color), huge_pages_(huge_pages),
+    pwm_bits_(kBitPlanes), row_pwm_bits_(rows / SUB_PANELS_, kBitPlanes),
+    do_luminance_correct_(true), brightness_(100),
+    dither_mode_(kDitherNone), dither_phase_(0),
     double_rows_(rows / SUB_PANELS_),
-    buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
-    shared_mapper_(mapper) {
+    first_plane_(kBitPlanes - planes), row_words_(columns * planes),
+    buffer_size_(BufferElements(rows, columns, planes) * sizeof(plane_bits_t)),
+    shared_mapper_(mapper), palette_settings_(0),
+    level_to_color_settings_(0) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
   assert(rows_ >=4 && rows_ <= 64 && rows_ % 2 == 0);
@@ -255,8 +557,17 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     abort();
   }
   assert(parallel >= 1 && parallel <= 3);
+  if (6 * parallel > BITPLANE_WORD_BITS) {
+    fprintf(stderr, "Compiled with BITPLANE_WORD_BITS=%d, which only has "
+            "room for the colors of %d parallel chain%s.\n",
+            BITPLANE_WORD_BITS, BITPLANE_WORD_BITS / 6,
+            BITPLANE_WORD_BITS / 6 > 1 ? "s" : "");
+    abort();
+  }
+  assert(planes >= 1 && planes <= kBitPlanes);
 
-  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  bitplane_buffer_ = AllocateBitplaneBuffer(buffer_size_, huge_pages_);
+  nonzero_planes_.resize(double_rows_, kAllPlanes);
 
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
@@ -274,9 +585,12 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     gpio_bits_t g = h.p0_g1 | h.p0_g2 | h.p1_g1 | h.p1_g2 | h.p2_g1 | h.p2_g2;
     gpio_bits_t b = h.p0_b1 | h.p0_b2 | h.p1_b1 | h.p1_b2 | h.p2_b1 | h.p2_b2;
     PixelDesignator fill_bits;
-    fill_bits.r_bit = GetGpioFromLedSequence('R', led_sequence, r, g, b);
-    fill_bits.g_bit = GetGpioFromLedSequence('G', led_sequence, r, g, b);
-    fill_bits.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
+    fill_bits.r_bit = PackColorBits(
+      GetGpioFromLedSequence('R', led_sequence, r, g, b));
+    fill_bits.g_bit = PackColorBits(
+      GetGpioFromLedSequence('G', led_sequence, r, g, b));
+    fill_bits.b_bit = PackColorBits(
+      GetGpioFromLedSequence('B', led_sequence, r, g, b));
 
     *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits);
     for (int y = 0; y < height_; ++y) {
@@ -284,13 +598,18 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
         InitDefaultDesignator(x, y, led_sequence, (*shared_mapper_)->get(x, y));
       }
     }
+    (*shared_mapper_)->CompileRuns();
   }
 
   Clear();
 }
 
 Framebuffer::~Framebuffer() {
-  delete [] bitplane_buffer_;
+  FreeBitplaneBuffer(bitplane_buffer_);
+}
+
+void Framebuffer::FreeBitplaneBuffer(plane_bits_t *buffer) const {
+  ReleaseBitplaneBuffer(buffer, buffer_size_, huge_pages_);
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -330,13 +649,16 @@ Framebuffer::~Framebuffer() {
       ++mapping->max_parallel_chains;
   }
   hardware_mapping_ = mapping;
+  InitColorPacking(*mapping);
 }
 
 /* static */ void Framebuffer::InitGPIO(GPIO *io, int rows, int parallel,
                                         bool allow_hardware_pulsing,
                                         int pwm_lsb_nanoseconds,
                                         int dither_bits,
-                                        int row_address_type) {
+                                        int row_address_type,
+                                        bool performance_governor,
+                                        bool scalable_pulses) {
   if (sOutputEnablePulser != NULL)
     return;  // already initialized.
 
@@ -389,7 +711,10 @@ Framebuffer::~Framebuffer() {
   }
   sOutputEnablePulser = PinPulser::Create(io, h.output_enable,
                                           allow_hardware_pulsing,
-                                          bitplane_timings);
+                                          bitplane_timings,
+                                          performance_governor,
+                                          scalable_pulses);
+  if (sOutputEnablePulser) sOutputEnablePulser->SetPulseScale(sPulseScale);
 }
 
 // NOTE: first version for panel initialization sequence, need to refine
@@ -443,16 +768,51 @@ static void InitFM6126(GPIO *io, const struct HardwareMapping &h, int columns) {
   }
 }
 
+/* static */ int Framebuffer::StoredPlanes(int pwm_bits) {
+#if BITPLANE_WORD_BITS < 32
+  return pwm_bits;
+#else
+  return kBitPlanes;
+#endif
+}
+
+/* static */ int Framebuffer::BufferElements(int rows, int columns,
+                                             int planes) {
+  return (rows / SUB_PANELS_) * columns * planes;
+}
+
 bool Framebuffer::SetPWMBits(uint8_t value) {
-  if (value < 1 || value > kBitPlanes)
+  if (value < 1 || value > kBitPlanes - first_plane_)
     return false;
   pwm_bits_ = value;
   return true;
 }
 
-inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
-  return &bitplane_buffer_[ double_row * (columns_ * kBitPlanes)
-                            + bit * columns_
+bool Framebuffer::SetRowPWMBits(int y, int height, uint8_t value) {
+  if (value < 1 || value > kBitPlanes)
+    return false;
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int end_y = std::min(y + height, mapper->height());
+  for (y = std::max(y, 0); y < end_y; ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+    const PixelDesignatorRun *const runs_end = run + run_count;
+    for (/**/; run < runs_end; ++run) {
+      if (run->gpio_word < 0) continue;
+      // Depending on the mapping, pixels of a run can be in different rows.
+      int word = run->gpio_word;
+      for (int i = 0; i < run->length; ++i, word += run->stride) {
+        row_pwm_bits_[word / row_words_] = value;
+      }
+    }
+  }
+  return true;
+}
+
+inline plane_bits_t *Framebuffer::ValueAt(int double_row, int column,
+                                          int bit) {
+  return &bitplane_buffer_[ double_row * row_words_
+                            + PlaneOffset(bit)
                             + column ];
 }
 
@@ -461,8 +821,58 @@ void Framebuffer::Clear() {
     Fill(0, 0, 0);
   } else  {
     // Cheaper.
-    memset(bitplane_buffer_, 0,
-           sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
+    memset(bitplane_buffer_, 0, buffer_size_);
+    std::fill(nonzero_planes_.begin(), nonzero_planes_.end(), 0);
+  }
+}
+
+inline void Framebuffer::MarkPlanes(int gpio_word, int count, int stride,
+                                    uint16_t planes) {
+  if (planes == 0) return;
+  const int first = gpio_word / row_words_;
+  const int last = (gpio_word + (count - 1) * stride) / row_words_;
+  for (int r = std::min(first, last); r <= std::max(first, last); ++r) {
+    nonzero_planes_[r] |= planes;
+  }
+}
+
+uint16_t Framebuffer::RowPlanes(int y) const {
+  uint16_t result = 0;
+  int run_count;
+  const PixelDesignatorRun *run = (*shared_mapper_)->GetRuns(y, &run_count);
+  for (const PixelDesignatorRun *const end = run + run_count;
+       run < end; ++run) {
+    if (run->gpio_word < 0) continue;
+    const int first = run->gpio_word / row_words_;
+    const int last = (run->gpio_word + (run->length - 1) * run->stride)
+      / row_words_;
+    for (int r = std::min(first, last); r <= std::max(first, last); ++r) {
+      result |= nonzero_planes_[r];
+    }
+  }
+  return result;
+}
+
+bool Framebuffer::IsBlank() const {
+  // With inverted colors, no bits set means full white.
+  if (inverse_color_) return false;
+  for (int row = 0; row < double_rows_; ++row) {
+    const int shown_bits = std::min(pwm_bits_, row_pwm_bits_[row]);
+    const uint16_t shown_planes
+      = kAllPlanes & ~((1 << (kBitPlanes - shown_bits)) - 1);
+    if (nonzero_planes_[row] & shown_planes)
+      return false;
+  }
+  return true;
+}
+
+void Framebuffer::MarkRowPlanes(int y, uint16_t planes) {
+  int run_count;
+  const PixelDesignatorRun *run = (*shared_mapper_)->GetRuns(y, &run_count);
+  for (const PixelDesignatorRun *const end = run + run_count;
+       run < end; ++run) {
+    if (run->gpio_word < 0) continue;
+    MarkPlanes(run->gpio_word, run->length, run->stride, planes);
   }
 }
 
@@ -499,7 +909,7 @@ static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
   return (shift > 0) ? (c << shift) : (c >> -shift);
 }
 
-inline void Framebuffer::MapColors(
+inline void Framebuffer::MapLevels(
   uint8_t r, uint8_t g, uint8_t b,
   uint16_t *red, uint16_t *green, uint16_t *blue) {
 
@@ -512,6 +922,16 @@ inline void Framebuffer::MapColors(
     *green = DirectMapColor(brightness_, g);
     *blue  = DirectMapColor(brightness_, b);
   }
+}
+
+inline void Framebuffer::FinishLevels(
+  uint16_t dither, uint16_t *red, uint16_t *green, uint16_t *blue) {
+  if (dither) {
+    const int max_level = (1 << kBitPlanes) - 1;
+    *red   = std::min(*red + dither, max_level);
+    *green = std::min(*green + dither, max_level);
+    *blue  = std::min(*blue + dither, max_level);
+  }
 
   if (inverse_color_) {
     *red = ~(*red);
@@ -520,20 +940,218 @@ inline void Framebuffer::MapColors(
   }
 }
 
+inline void Framebuffer::MapColors(
+  uint8_t r, uint8_t g, uint8_t b,
+  uint16_t *red, uint16_t *green, uint16_t *blue) {
+  MapLevels(r, g, b, red, green, blue);
+  FinishLevels(0, red, green, blue);
+}
+
+// Threshold patterns for dithering, each threshold in the range 0..255.
+// Tiled over the canvas, so both patterns are kDitherTileSize square.
+enum {
+  kDitherTileBits = 5,
+  kDitherTileSize = 1 << kDitherTileBits,
+  kDitherTilePixels = kDitherTileSize * kDitherTileSize,
+};
+
+struct DitherTile {
+  uint8_t threshold[kDitherTilePixels];
+};
+
+// Classic 8x8 Bayer matrix. Regular cross-hatch pattern, but cheap and
+// stable, good for flat areas.
+static DitherTile *CreateOrderedDitherTile() {
+  DitherTile *tile = new DitherTile();
+  for (int y = 0; y < kDitherTileSize; ++y) {
+    for (int x = 0; x < kDitherTileSize; ++x) {
+      int value = 0;
+      for (int bit = 0; bit < 3; ++bit) {
+        const int xb = (x >> bit) & 1;
+        const int yb = (y >> bit) & 1;
+        value = (value << 2) | ((xb ^ yb) << 1) | yb;
+      }
+      tile->threshold[y * kDitherTileSize + x] = value * 4;
+    }
+  }
+  return tile;
+}
+
+// Blue noise: thresholds without low-frequency structure, so the pattern
+// is much less visible than the Bayer matrix. Created with the void-and-
+// cluster idea: pixels are ranked in the order they are placed, each time
+// into the largest remaining void, measured with a gaussian filter (sigma 1.5)
+// that wraps around the tile edges.
+static DitherTile *CreateBlueNoiseDitherTile() {
+  float kernel[kDitherTilePixels];
+  for (int y = 0; y < kDitherTileSize; ++y) {
+    for (int x = 0; x < kDitherTileSize; ++x) {
+      const int dx = std::min(x, kDitherTileSize - x);
+      const int dy = std::min(y, kDitherTileSize - y);
+      kernel[y * kDitherTileSize + x] = expf(-(dx*dx + dy*dy) / 4.5f);
+    }
+  }
+
+  // Tiny deterministic jitter, so that ties don't result in regular patterns.
+  float energy[kDitherTilePixels];
+  bool placed[kDitherTilePixels];
+  uint32_t random = 1;
+  for (int i = 0; i < kDitherTilePixels; ++i) {
+    random = random * 1103515245 + 12345;
+    energy[i] = (random >> 16) * 1e-9f;
+    placed[i] = false;
+  }
+
+  DitherTile *tile = new DitherTile();
+  for (int rank = 0; rank < kDitherTilePixels; ++rank) {
+    int best = -1;
+    for (int i = 0; i < kDitherTilePixels; ++i) {
+      if (!placed[i] && (best < 0 || energy[i] < energy[best]))
+        best = i;
+    }
+    placed[best] = true;
+    tile->threshold[best] = rank * 256 / kDitherTilePixels;
+    const int bx = best % kDitherTileSize;
+    const int by = best / kDitherTileSize;
+    for (int y = 0; y < kDitherTileSize; ++y) {
+      const float *kernel_row
+        = kernel + ((y - by) & (kDitherTileSize - 1)) * kDitherTileSize;
+      float *energy_row = energy + y * kDitherTileSize;
+      for (int x = 0; x < kDitherTileSize; ++x) {
+        energy_row[x] += kernel_row[(x - bx) & (kDitherTileSize - 1)];
+      }
+    }
+  }
+  return tile;
+}
+
+bool Framebuffer::SetDither(int mode) {
+  if (mode < kDitherNone || mode > kDitherBlueNoise)
+    return false;
+  dither_mode_ = mode;
+  return true;
+}
+
+const uint8_t *Framebuffer::DitherRow(int y) const {
+  if (pwm_bits_ == kBitPlanes) return NULL;  // All levels representable.
+  const DitherTile *tile;
+  switch (dither_mode_) {
+  case kDitherOrdered: {
+    static const DitherTile *ordered = CreateOrderedDitherTile();
+    tile = ordered;
+    break;
+  }
+  case kDitherBlueNoise: {
+    static const DitherTile *blue_noise = CreateBlueNoiseDitherTile();
+    tile = blue_noise;
+    break;
+  }
+  default:
+    return NULL;
+  }
+  return tile->threshold + (y & (kDitherTileSize - 1)) * kDitherTileSize;
+}
+
+inline uint16_t Framebuffer::DitherOffset(const uint8_t *dither_row,
+                                          int x) const {
+  // Shifting all thresholds by the golden ratio for each phase is a cheap
+  // way to get thresholds that are evenly distributed over time as well.
+  const int threshold = (dither_row[x & (kDitherTileSize - 1)]
+                         + dither_phase_ * 159) & 0xff;
+  // Scale to the range of levels that are dropped with the pwm bits.
+  return (threshold << (kBitPlanes - pwm_bits_)) >> 8;
+}
+
+inline bool Framebuffer::NeedsDither(uint16_t red, uint16_t green,
+                                     uint16_t blue) const {
+  const uint16_t dropped_mask = (1 << (kBitPlanes - pwm_bits_)) - 1;
+  return ((red | green | blue) & dropped_mask) != 0;
+}
+
+// The fraction of light the color mapping with "percent" brightness leaves
+// of full white.
+static float BrightnessFraction(uint8_t percent, bool luminance_correct) {
+  return luminance_correct
+    ? luminance_cie1931(255, percent) / ((1 << kBitPlanes) - 1)
+    : percent / 100.0f;
+}
+
+/* static */ uint8_t Framebuffer::SetPulseBrightness(uint8_t percent,
+                                                     bool luminance_correct) {
+  if (percent < 1) percent = 1;
+  if (percent > 100) percent = 100;
+  const float fraction = BrightnessFraction(percent, luminance_correct);
+  const int min_scale = sOutputEnablePulser
+    ? sOutputEnablePulser->MinProportionalScale() : 1;
+  sPulseScale = lrintf(fraction * PinPulser::kFullPulseScale);
+  uint8_t color_percent = 100;
+  if (sPulseScale < min_scale) {
+    // Shorter pulses would merge the darkest levels; dim the rest with the
+    // colors instead.
+    const float remaining = fraction * PinPulser::kFullPulseScale / min_scale;
+    while (color_percent > 1
+           && BrightnessFraction(color_percent - 1, luminance_correct)
+           >= remaining) {
+      --color_percent;
+    }
+    sPulseScale = min_scale;
+  }
+  if (sOutputEnablePulser) sOutputEnablePulser->SetPulseScale(sPulseScale);
+  return color_percent;
+}
+
+void Framebuffer::UpdateLevelToColor() {
+  const uint32_t settings = color_settings() | (pwm_bits_ << 16);
+  if (!level_to_color_.empty() && level_to_color_settings_ == settings)
+    return;
+  // Only the levels in the planes shown are visible.
+  const uint16_t shown_mask = ((1 << kBitPlanes) - 1)
+    & ~((1 << (kBitPlanes - pwm_bits_)) - 1);
+  // The mapping is monotonic, so for each level the smallest color mapping
+  // to at least that level is found by walking through both.
+  level_to_color_.resize(1 << kBitPlanes);
+  int color = 0;
+  for (int level = 0; level < (1 << kBitPlanes); ++level) {
+    while (color < 255) {
+      const uint16_t mapped = do_luminance_correct_
+        ? CIEMapColor(brightness_, color)
+        : DirectMapColor(brightness_, color);
+      if ((mapped & shown_mask) >= level) break;
+      ++color;
+    }
+    level_to_color_[level] = color;
+  }
+  level_to_color_settings_ = settings;
+}
+
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+  MapLevels(r, g, b, &red, &green, &blue);
+  if (dither_mode_ != kDitherNone && NeedsDither(red, green, blue)) {
+    for (int y = 0; y < height(); ++y) {
+      FillSpan(0, y, width(), r, g, b);
+    }
+    return;
+  }
+  FinishLevels(0, &red, &green, &blue);
   const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
+  // All shown planes are overwritten, the others stay.
+  const uint16_t shown_planes
+    = kAllPlanes & ~((1 << (kBitPlanes - pwm_bits_)) - 1);
+  for (int row = 0; row < double_rows_; ++row) {
+    nonzero_planes_[row] = ((nonzero_planes_[row] & ~shown_planes)
+                            | ((red | green | blue) & shown_planes));
+  }
 
   for (int b = kBitPlanes - pwm_bits_; b < kBitPlanes; ++b) {
     uint16_t mask = 1 << b;
-    gpio_bits_t plane_bits = 0;
+    plane_bits_t plane_bits = 0;
     plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
     plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
     plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
 
     for (int row = 0; row < double_rows_; ++row) {
-      uint32_t *row_data = ValueAt(row, 0, b);
+      plane_bits_t *row_data = ValueAt(row, 0, b);
       for (int col = 0; col < columns_; ++col) {
         *row_data++ = plane_bits;
       }
@@ -541,6 +1159,246 @@ void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   }
 }
 
+void Framebuffer::PrepareColor(uint8_t r, uint8_t g, uint8_t b,
+                               PlaneColor *color) {
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+  for (int i = 0; i < kBitPlanes; ++i) {
+    const uint16_t mask = 1 << i;
+    color->plane[i] = (((red & mask) ? 1 : 0)
+                       | ((green & mask) ? 2 : 0)
+                       | ((blue & mask) ? 4 : 0));
+  }
+}
+
+void Framebuffer::UpdatePalette() {
+  if (palette_.empty()) {
+    palette_rgb_.resize(3 * kPaletteSize, 0);
+    palette_.resize(kPaletteSize);
+    palette_set_.resize(kPaletteSize, false);
+  } else if (palette_settings_ == color_settings()) {
+    return;
+  }
+  for (int i = 0; i < kPaletteSize; ++i) {
+    const uint8_t *rgb = &palette_rgb_[3 * i];
+    PrepareColor(rgb[0], rgb[1], rgb[2], &palette_[i]);
+  }
+  palette_settings_ = color_settings();
+}
+
+void Framebuffer::SetPaletteColor(uint8_t index,
+                                  uint8_t r, uint8_t g, uint8_t b,
+                                  bool recolor) {
+  UpdatePalette();
+  const PlaneColor previous = palette_[index];
+  palette_rgb_[3 * index + 0] = r;
+  palette_rgb_[3 * index + 1] = g;
+  palette_rgb_[3 * index + 2] = b;
+  PrepareColor(r, g, b, &palette_[index]);
+  const bool was_set = palette_set_[index];
+  palette_set_[index] = true;
+  // Pixels can only have the color of an entry that was set before;
+  // otherwise, this would recolor everything black.
+  if (!recolor || !was_set) return;
+
+  // Find all pixels with the previous color by looking at their bits in
+  // each plane.
+  const PlaneColor &color = palette_[index];
+  const PixelDesignatorMap *const map = *shared_mapper_;
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (int y = 0; y < map->height(); ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = map->GetRuns(y, &run_count);
+    for (const PixelDesignatorRun *const end = run + run_count;
+         run < end; ++run) {
+      if (run->gpio_word < 0) continue;
+      plane_bits_t *pixel_bits = (bitplane_buffer_ + run->gpio_word
+                                  + PlaneOffset(min_bit_plane));
+      for (int i = 0; i < run->length; ++i, pixel_bits += run->stride) {
+        bool matches = true;
+        plane_bits_t *bits = pixel_bits;
+        for (int b = min_bit_plane; matches && b < kBitPlanes;
+             ++b, bits += columns_) {
+          const uint8_t channels = (((*bits & run->r_bit) ? 1 : 0)
+                                    | ((*bits & run->g_bit) ? 2 : 0)
+                                    | ((*bits & run->b_bit) ? 4 : 0));
+          matches = (channels == previous.plane[b]);
+        }
+        if (!matches) continue;
+        MarkPlanes(pixel_bits - bitplane_buffer_ - PlaneOffset(min_bit_plane),
+                   1, 0, PlaneMask(color));
+        bits = pixel_bits;
+        for (int b = min_bit_plane; b < kBitPlanes; ++b, bits += columns_) {
+          const uint8_t channels = color.plane[b];
+          plane_bits_t color_bits = 0;
+          if (channels & 1) color_bits |= run->r_bit;
+          if (channels & 2) color_bits |= run->g_bit;
+          if (channels & 4) color_bits |= run->b_bit;
+          *bits = (*bits & run->mask) | color_bits;
+        }
+      }
+    }
+  }
+}
+
+void Framebuffer::SetIndexedRow(int x, int y, int width,
+                                const uint8_t *indices) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (y < 0 || y >= mapper->height()) return;
+  if (x < 0) {
+    width += x;
+    indices -= x;
+    x = 0;
+  }
+  const int end_x = std::min(x + width, mapper->width());
+  if (x >= end_x) return;
+  UpdatePalette();
+
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  int run_count;
+  const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+  const PixelDesignatorRun *const runs_end = run + run_count;
+  for (/**/; run < runs_end && run->x < end_x; ++run) {
+    if (run->gpio_word < 0 || run->x + run->length <= x) continue;
+    // The bits to set for each combination of color channels in this run.
+    plane_bits_t channel_bits[8];
+    for (int c = 0; c < 8; ++c) {
+      channel_bits[c] = (((c & 1) ? run->r_bit : 0)
+                         | ((c & 2) ? run->g_bit : 0)
+                         | ((c & 4) ? run->b_bit : 0));
+    }
+    const int from = std::max(x, run->x);
+    const int count = std::min(end_x, run->x + run->length) - from;
+    const uint32_t designator_mask = run->mask;
+    const uint8_t *index = indices + (from - x);
+    plane_bits_t *bits = (bitplane_buffer_ + run->gpio_word
+                          + (from - run->x) * run->stride
+                          + PlaneOffset(min_bit_plane));
+    uint16_t planes = 0;
+    for (int i = 0; i < count; ++i, ++index, bits += run->stride) {
+      const PlaneColor &color = palette_[*index];
+      planes |= PlaneMask(color);
+      plane_bits_t *plane_bits = bits;
+      for (int b = min_bit_plane; b < kBitPlanes; ++b, plane_bits += columns_) {
+        *plane_bits = ((*plane_bits & designator_mask)
+                       | channel_bits[color.plane[b]]);
+      }
+    }
+    MarkPlanes(run->gpio_word + (from - run->x) * run->stride, count,
+               run->stride, planes);
+  }
+}
+
+uint32_t Framebuffer::color_settings() const {
+  return (brightness_ | (do_luminance_correct_ << 8) | (inverse_color_ << 9));
+}
+
+void Framebuffer::DrawBitmap(int x, int y, int width, int height,
+                             const uint64_t *rows,
+                             const PlaneColor &foreground,
+                             const PlaneColor *background) {
+  const PixelDesignatorMap *const map = *shared_mapper_;
+  const int x_start = std::max(x, 0);
+  const int x_end = std::min(x + std::min(width, 64), map->width());
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const uint16_t planes = (PlaneMask(foreground)
+                           | (background ? PlaneMask(*background) : 0));
+  for (int row = 0; row < height; ++row) {
+    const int pos_y = y + row;
+    if (pos_y < 0 || pos_y >= map->height()) continue;
+    const uint64_t bitmap = rows[row];
+    int run_count;
+    const PixelDesignatorRun *run = map->GetRuns(pos_y, &run_count);
+    const PixelDesignatorRun *const run_end = run + run_count;
+    while (run < run_end && run->x + run->length <= x_start) ++run;
+    for (int pos_x = x_start; run < run_end && pos_x < x_end; ++run) {
+      const int segment_end = std::min(run->x + run->length, x_end);
+      if (run->gpio_word < 0) {
+        pos_x = segment_end;
+        continue;
+      }
+      // The gpio bits for each combination of PlaneColor channels.
+      plane_bits_t channel_bits[8];
+      channel_bits[0] = 0;
+      channel_bits[1] = run->r_bit;
+      channel_bits[2] = run->g_bit;
+      channel_bits[3] = run->r_bit | run->g_bit;
+      channel_bits[4] = run->b_bit;
+      channel_bits[5] = run->r_bit | run->b_bit;
+      channel_bits[6] = run->g_bit | run->b_bit;
+      channel_bits[7] = run->r_bit | run->g_bit | run->b_bit;
+      const uint32_t designator_mask = run->mask;
+      MarkPlanes(run->gpio_word + (pos_x - run->x) * run->stride,
+                 segment_end - pos_x, run->stride, planes);
+      plane_bits_t *bits = bitplane_buffer_ + run->gpio_word
+        + (pos_x - run->x) * run->stride + PlaneOffset(min_bit_plane);
+      for (/**/; pos_x < segment_end; ++pos_x, bits += run->stride) {
+        const bool is_set = (bitmap << (pos_x - x)) & (1ULL << 63);
+        const PlaneColor *const color = is_set ? &foreground : background;
+        if (color == NULL) continue;
+        plane_bits_t *plane_bits = bits;
+        for (int b = min_bit_plane; b < kBitPlanes; ++b) {
+          *plane_bits = ((*plane_bits & designator_mask)
+                         | channel_bits[color->plane[b]]);
+          plane_bits += columns_;
+        }
+      }
+    }
+  }
+}
+
+plane_bits_t *Framebuffer::CreateRemappedBuffer(
+  const PixelDesignatorMap &from, const PixelDesignatorMap &to) const {
+  plane_bits_t *result = AllocateBitplaneBuffer(buffer_size_, huge_pages_);
+  memcpy(result, bitplane_buffer_, buffer_size_);
+
+  // First switch off all pixels of the old mapping ...
+  for (int y = 0; y < from.height(); ++y) {
+    for (int x = 0; x < from.width(); ++x) {
+      const PixelDesignator *d = from.get(x, y);
+      if (d->gpio_word < 0) continue;
+      const plane_bits_t off = inverse_color_ ? ~d->mask : 0;
+      plane_bits_t *bits = result + d->gpio_word;
+      for (int b = first_plane_; b < kBitPlanes; ++b, bits += columns_) {
+        *bits = (*bits & d->mask) | off;
+      }
+    }
+  }
+
+  // .. then move the bits of each pixel to its new place.
+  const int width = std::min(from.width(), to.width());
+  const int height = std::min(from.height(), to.height());
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const PixelDesignator *src = from.get(x, y);
+      const PixelDesignator *dst = to.get(x, y);
+      if (src->gpio_word < 0 || dst->gpio_word < 0) continue;
+      const plane_bits_t *in = bitplane_buffer_ + src->gpio_word;
+      plane_bits_t *out = result + dst->gpio_word;
+      for (int b = first_plane_; b < kBitPlanes;
+           ++b, in += columns_, out += columns_) {
+        const plane_bits_t value = *in;
+        *out = ((*out & dst->mask)
+                | ((value & src->r_bit) ? dst->r_bit : 0)
+                | ((value & src->g_bit) ? dst->g_bit : 0)
+                | ((value & src->b_bit) ? dst->b_bit : 0));
+      }
+    }
+  }
+  return result;
+}
+
+plane_bits_t *Framebuffer::ReplaceBitplaneBuffer(plane_bits_t *buffer) {
+  plane_bits_t *const previous = bitplane_buffer_;
+  bitplane_buffer_ = buffer;
+  // The overlay mask and the per-row PWM bits refer to the rows of the
+  // previous mapping; start over.
+  std::fill(overlay_mask_.begin(), overlay_mask_.end(), 0);
+  std::fill(row_pwm_bits_.begin(), row_pwm_bits_.end(), kBitPlanes);
+  std::fill(nonzero_planes_.begin(), nonzero_planes_.end(), kAllPlanes);
+  return previous;
+}
+
 int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
@@ -551,11 +1409,15 @@ void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   if (pos < 0) return;  // non-used pixel marker.
 
   uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+  MapLevels(r, g, b, &red, &green, &blue);
+  const uint8_t *const dither_row = DitherRow(y);
+  FinishLevels(dither_row ? DitherOffset(dither_row, x) : 0,
+               &red, &green, &blue);
+  MarkPlanes(pos, 1, 0, red | green | blue);
 
-  uint32_t *bits = bitplane_buffer_ + pos;
+  plane_bits_t *bits = bitplane_buffer_ + pos;
   const int min_bit_plane = kBitPlanes - pwm_bits_;
-  bits += (columns_ * min_bit_plane);
+  bits += PlaneOffset(min_bit_plane);
   const uint32_t r_bits = designator->r_bit;
   const uint32_t g_bits = designator->g_bit;
   const uint32_t b_bits = designator->b_bit;
@@ -570,6 +1432,455 @@ void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   }
 }
 
+void Framebuffer::SetPixel(int x, int y, const PlaneColor &color) {
+  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  if (designator == NULL) return;
+  const int pos = designator->gpio_word;
+  if (pos < 0) return;  // non-used pixel marker.
+
+  MarkPlanes(pos, 1, 0, PlaneMask(color));
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  plane_bits_t *bits = bitplane_buffer_ + pos + PlaneOffset(min_bit_plane);
+  const uint32_t designator_mask = designator->mask;
+  for (int b = min_bit_plane; b < kBitPlanes; ++b, bits += columns_) {
+    const uint8_t channels = color.plane[b];
+    uint32_t color_bits = 0;
+    if (channels & 1) color_bits |= designator->r_bit;
+    if (channels & 2) color_bits |= designator->g_bit;
+    if (channels & 4) color_bits |= designator->b_bit;
+    *bits = (*bits & designator_mask) | color_bits;
+  }
+}
+
+void Framebuffer::FillSpan(int x, int y, int width,
+                           uint8_t r, uint8_t g, uint8_t b) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (y < 0 || y >= mapper->height()) return;
+  if (x < 0) {
+    width += x;
+    x = 0;
+  }
+  const int end_x = std::min(x + width, mapper->width());
+  if (x >= end_x) return;
+
+  uint16_t red, green, blue;
+  MapLevels(r, g, b, &red, &green, &blue);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const uint8_t *dither_row = DitherRow(y);
+  if (dither_row && !NeedsDither(red, green, blue)) {
+    dither_row = NULL;  // Same levels for all pixels anyway.
+  }
+  const uint16_t levels[3] = { red, green, blue };
+  if (!dither_row) FinishLevels(0, &red, &green, &blue);
+
+  int run_count;
+  const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+  const PixelDesignatorRun *const runs_end = run + run_count;
+  for (/**/; run < runs_end && run->x < end_x; ++run) {
+    if (run->gpio_word < 0 || run->x + run->length <= x) continue;
+    const int from = std::max(x, run->x);
+    const int count = std::min(end_x, run->x + run->length) - from;
+    const int stride = run->stride;
+    const uint32_t designator_mask = run->mask;
+    const int first_word = run->gpio_word + (from - run->x) * stride;
+    plane_bits_t *plane_start = (bitplane_buffer_ + first_word
+                              + PlaneOffset(min_bit_plane));
+    if (dither_row) {
+      // Levels differ from pixel to pixel.
+      uint16_t planes = 0;
+      for (int i = 0; i < count; ++i, plane_start += stride) {
+        red = levels[0];
+        green = levels[1];
+        blue = levels[2];
+        FinishLevels(DitherOffset(dither_row, from + i), &red, &green, &blue);
+        planes |= red | green | blue;
+        plane_bits_t *bits = plane_start;
+        for (int b = min_bit_plane; b < kBitPlanes; ++b, bits += columns_) {
+          const uint16_t mask = 1 << b;
+          uint32_t color_bits = 0;
+          if (red & mask)   color_bits |= run->r_bit;
+          if (green & mask) color_bits |= run->g_bit;
+          if (blue & mask)  color_bits |= run->b_bit;
+          *bits = (*bits & designator_mask) | color_bits;
+        }
+      }
+      MarkPlanes(first_word, count, stride, planes);
+      continue;
+    }
+    MarkPlanes(first_word, count, stride, red | green | blue);
+    for (int b = min_bit_plane; b < kBitPlanes; ++b, plane_start += columns_) {
+      const uint16_t mask = 1 << b;
+      uint32_t color_bits = 0;
+      if (red & mask)   color_bits |= run->r_bit;
+      if (green & mask) color_bits |= run->g_bit;
+      if (blue & mask)  color_bits |= run->b_bit;
+      plane_bits_t *bits = plane_start;
+      for (int i = 0; i < count; ++i, bits += stride) {
+        *bits = (*bits & designator_mask) | color_bits;
+      }
+    }
+  }
+}
+
+void Framebuffer::SetRow(int x, int y, int width, const uint8_t *rgb) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (y < 0 || y >= mapper->height()) return;
+  if (x < 0) {
+    width += x;
+    rgb -= 3 * x;
+    x = 0;
+  }
+  const int end_x = std::min(x + width, mapper->width());
+  if (x >= end_x) return;
+
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const uint8_t *const dither_row = DitherRow(y);
+  // Neighboring pixels often have the same color; only map if different.
+  uint8_t last_r = rgb[0], last_g = rgb[1], last_b = rgb[2];
+  uint16_t level_r, level_g, level_b;
+  MapLevels(last_r, last_g, last_b, &level_r, &level_g, &level_b);
+  uint16_t red = level_r, green = level_g, blue = level_b;
+  FinishLevels(0, &red, &green, &blue);
+
+  int run_count;
+  const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+  const PixelDesignatorRun *const runs_end = run + run_count;
+  for (/**/; run < runs_end && run->x < end_x; ++run) {
+    if (run->gpio_word < 0 || run->x + run->length <= x) continue;
+    const int from = std::max(x, run->x);
+    const int count = std::min(end_x, run->x + run->length) - from;
+    const int stride = run->stride;
+    const uint32_t designator_mask = run->mask;
+    const uint8_t *pixel = rgb + 3 * (from - x);
+    const int first_word = run->gpio_word + (from - run->x) * stride;
+    plane_bits_t *bits = (bitplane_buffer_ + first_word
+                       + PlaneOffset(min_bit_plane));
+    uint16_t planes = 0;
+    for (int i = 0; i < count; ++i, pixel += 3, bits += stride) {
+      if (pixel[0] != last_r || pixel[1] != last_g || pixel[2] != last_b) {
+        last_r = pixel[0];
+        last_g = pixel[1];
+        last_b = pixel[2];
+        MapLevels(last_r, last_g, last_b, &level_r, &level_g, &level_b);
+        red = level_r;
+        green = level_g;
+        blue = level_b;
+        FinishLevels(0, &red, &green, &blue);
+      }
+      if (dither_row) {
+        red = level_r;
+        green = level_g;
+        blue = level_b;
+        FinishLevels(DitherOffset(dither_row, from + i), &red, &green, &blue);
+      }
+      planes |= red | green | blue;
+      plane_bits_t *plane_bits = bits;
+      for (int b = min_bit_plane; b < kBitPlanes; ++b, plane_bits += columns_) {
+        const uint16_t mask = 1 << b;
+        uint32_t color_bits = 0;
+        if (red & mask)   color_bits |= run->r_bit;
+        if (green & mask) color_bits |= run->g_bit;
+        if (blue & mask)  color_bits |= run->b_bit;
+        *plane_bits = (*plane_bits & designator_mask) | color_bits;
+      }
+    }
+    MarkPlanes(first_word, count, stride, planes);
+  }
+}
+
+// Root of the set "i" is part of, with path halving.
+static int FindRowSet(std::vector<int> *parent, int i) {
+  while ((*parent)[i] != i) {
+    (*parent)[i] = (*parent)[(*parent)[i]];
+    i = (*parent)[i];
+  }
+  return i;
+}
+
+int Framebuffer::GetRowGroups(std::vector<int> *group_of_row) const {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  // Join all double rows written by the same row; the double rows touched
+  // by a run are the same range that MarkPlanes() updates.
+  std::vector<int> parent(double_rows_);
+  for (int r = 0; r < double_rows_; ++r) parent[r] = r;
+  std::vector<int> first_double_row(mapper->height(), -1);
+  for (int y = 0; y < mapper->height(); ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+    for (const PixelDesignatorRun *const end = run + run_count;
+         run < end; ++run) {
+      if (run->gpio_word < 0) continue;
+      const int first = run->gpio_word / row_words_;
+      const int last = (run->gpio_word + (run->length - 1) * run->stride)
+        / row_words_;
+      if (first_double_row[y] < 0) first_double_row[y] = first;
+      const int root = FindRowSet(&parent, first_double_row[y]);
+      for (int r = std::min(first, last); r <= std::max(first, last); ++r) {
+        parent[FindRowSet(&parent, r)] = root;
+      }
+    }
+  }
+
+  // Number the sets in use.
+  std::vector<int> group_of_set(double_rows_, -1);
+  int groups = 0;
+  group_of_row->resize(mapper->height());
+  for (int y = 0; y < mapper->height(); ++y) {
+    if (first_double_row[y] < 0) {
+      (*group_of_row)[y] = -1;
+      continue;
+    }
+    const int set = FindRowSet(&parent, first_double_row[y]);
+    if (group_of_set[set] < 0) group_of_set[set] = groups++;
+    (*group_of_row)[y] = group_of_set[set];
+  }
+  return groups;
+}
+
+bool Framebuffer::HasLinearRows() const {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (mapper->width() != columns_) return false;
+  for (int y = 0; y < mapper->height(); ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+    if (run_count != 1 || run->gpio_word < 0 || run->stride != 1
+        || run->gpio_word % columns_ != 0)
+      return false;
+  }
+  return true;
+}
+
+void Framebuffer::CopyRow(int src_x, int src_y, int dst_x, int dst_y,
+                          int width) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  MarkRowPlanes(dst_y, RowPlanes(src_y));
+  int run_count;
+  const PixelDesignatorRun *src_run = mapper->GetRuns(src_y, &run_count);
+  const PixelDesignatorRun *const src_end = src_run + run_count;
+  const PixelDesignatorRun *dst_run = mapper->GetRuns(dst_y, &run_count);
+  const PixelDesignatorRun *const dst_end = dst_run + run_count;
+
+  // Split into segments in which neither source nor destination run changes.
+  copy_segments_.clear();
+  for (int offset = 0; offset < width; /**/) {
+    while (src_run < src_end && src_run->x + src_run->length <= src_x + offset)
+      ++src_run;
+    while (dst_run < dst_end && dst_run->x + dst_run->length <= dst_x + offset)
+      ++dst_run;
+    if (src_run == src_end || dst_run == dst_end) break;  // Can't happen.
+    CopySegment segment;
+    segment.offset = offset;
+    segment.count = std::min(std::min(src_run->x + src_run->length - src_x,
+                                      dst_run->x + dst_run->length - dst_x),
+                             width) - offset;
+    segment.src = src_run;
+    segment.dst = dst_run;
+    copy_segments_.push_back(segment);
+    offset += segment.count;
+  }
+
+  // If we copy to the right within the same row, we have to go backwards
+  // to not overwrite pixels before they are copied.
+  const bool backwards = (src_y == dst_y && dst_x > src_x);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (size_t i = 0; i < copy_segments_.size(); ++i) {
+    const CopySegment &segment
+      = copy_segments_[backwards ? copy_segments_.size() - i - 1 : i];
+    const PixelDesignatorRun &src = *segment.src;
+    const PixelDesignatorRun &dst = *segment.dst;
+    if (dst.gpio_word < 0) continue;
+    if (src.gpio_word < 0) {  // Unused pixels are considered black.
+      FillSpan(dst_x + segment.offset, dst_y, segment.count, 0, 0, 0);
+      continue;
+    }
+    int src_step = src.stride;
+    int dst_step = dst.stride;
+    int first = 0;
+    if (backwards) {
+      first = segment.count - 1;
+      src_step = -src_step;
+      dst_step = -dst_step;
+    }
+    const plane_bits_t *src_plane = (bitplane_buffer_ + src.gpio_word
+                                     + (src_x + segment.offset + first - src.x)
+                                     * src.stride
+                                     + PlaneOffset(min_bit_plane));
+    plane_bits_t *dst_plane = (bitplane_buffer_ + dst.gpio_word
+                               + (dst_x + segment.offset + first - dst.x)
+                               * dst.stride
+                               + PlaneOffset(min_bit_plane));
+    const bool same_bits = (src.r_bit == dst.r_bit && src.g_bit == dst.g_bit
+                            && src.b_bit == dst.b_bit);
+    for (int b = min_bit_plane; b < kBitPlanes;
+         ++b, src_plane += columns_, dst_plane += columns_) {
+      const plane_bits_t *from = src_plane;
+      plane_bits_t *to = dst_plane;
+      if (same_bits) {
+        for (int n = 0; n < segment.count; ++n, from += src_step, to += dst_step) {
+          *to = (*to & dst.mask) | (*from & ~src.mask);
+        }
+      } else {
+        for (int n = 0; n < segment.count; ++n, from += src_step, to += dst_step) {
+          plane_bits_t color_bits = 0;
+          if (*from & src.r_bit) color_bits |= dst.r_bit;
+          if (*from & src.g_bit) color_bits |= dst.g_bit;
+          if (*from & src.b_bit) color_bits |= dst.b_bit;
+          *to = (*to & dst.mask) | color_bits;
+        }
+      }
+    }
+  }
+}
+
+void Framebuffer::CopyRegion(int x, int y, int width, int height,
+                             int dst_x, int dst_y) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  // Clip, so that both, source and destination are within the canvas.
+  if (x < 0)     { width += x;      dst_x -= x; x = 0; }
+  if (dst_x < 0) { width += dst_x;  x -= dst_x; dst_x = 0; }
+  if (y < 0)     { height += y;     dst_y -= y; y = 0; }
+  if (dst_y < 0) { height += dst_y; y -= dst_y; dst_y = 0; }
+  width = std::min(width, mapper->width() - std::max(x, dst_x));
+  height = std::min(height, mapper->height() - std::max(y, dst_y));
+  if (width <= 0 || height <= 0) return;
+  if (x == dst_x && y == dst_y) return;
+
+  if (y == 0 && dst_y == 0 && height == mapper->height() && HasLinearRows()) {
+    // Moving full columns, which map to columns of gpio words: all pixels
+    // sharing a gpio word move together, so we can move the words.
+    for (int row = 0; row < double_rows_; ++row) {
+      for (int b = kBitPlanes - pwm_bits_; b < kBitPlanes; ++b) {
+        memmove(ValueAt(row, dst_x, b), ValueAt(row, x, b),
+                width * sizeof(plane_bits_t));
+      }
+    }
+    return;
+  }
+
+  if (dst_y > y) {  // Bottom up, so that we don't overwrite our source.
+    for (int row = height - 1; row >= 0; --row)
+      CopyRow(x, y + row, dst_x, dst_y + row, width);
+  } else {
+    for (int row = 0; row < height; ++row)
+      CopyRow(x, y + row, dst_x, dst_y + row, width);
+  }
+}
+
+void Framebuffer::ScrollRegion(int x, int y, int width, int height,
+                               int dx, int dy,
+                               uint8_t r, uint8_t g, uint8_t b) {
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  if (x < 0)     { width += x;  x = 0; }
+  if (y < 0)     { height += y; y = 0; }
+  width = std::min(width, mapper->width() - x);
+  height = std::min(height, mapper->height() - y);
+  if (width <= 0 || height <= 0) return;
+  if (abs(dx) >= width || abs(dy) >= height) {
+    for (int row = y; row < y + height; ++row)
+      FillSpan(x, row, width, r, g, b);
+    return;
+  }
+
+  // Source is the part of the rectangle that stays visible.
+  const int src_x = dx > 0 ? x : x - dx;
+  const int src_y = dy > 0 ? y : y - dy;
+  CopyRegion(src_x, src_y, width - abs(dx), height - abs(dy),
+             src_x + dx, src_y + dy);
+
+  // Fill what is uncovered.
+  const int fill_rows_start = dy > 0 ? y : y + height + dy;
+  for (int row = fill_rows_start; row < fill_rows_start + abs(dy); ++row)
+    FillSpan(x, row, width, r, g, b);
+  const int fill_columns_start = dx > 0 ? x : x + width + dx;
+  const int rows_start = dy > 0 ? y + dy : y;
+  for (int row = rows_start; row < rows_start + height - abs(dy); ++row)
+    FillSpan(fill_columns_start, row, abs(dx), r, g, b);
+}
+
+inline void Framebuffer::ReadLevels(const plane_bits_t *bits,
+                                    plane_bits_t r_bit, plane_bits_t g_bit,
+                                    plane_bits_t b_bit,
+                                    uint16_t *red, uint16_t *green,
+                                    uint16_t *blue) const {
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  bits += PlaneOffset(min_bit_plane);
+  uint16_t r = 0, g = 0, b = 0;
+  for (int plane = min_bit_plane; plane < kBitPlanes;
+       ++plane, bits += columns_) {
+    const uint16_t mask = 1 << plane;
+    if (*bits & r_bit) r |= mask;
+    if (*bits & g_bit) g |= mask;
+    if (*bits & b_bit) b |= mask;
+  }
+  if (inverse_color_) {
+    const uint16_t shown_mask = ((1 << kBitPlanes) - 1)
+      & ~((1 << min_bit_plane) - 1);
+    r = ~r & shown_mask;
+    g = ~g & shown_mask;
+    b = ~b & shown_mask;
+  }
+  *red = r;
+  *green = g;
+  *blue = b;
+}
+
+bool Framebuffer::GetPixelLevels(int x, int y, uint16_t *red,
+                                 uint16_t *green, uint16_t *blue) const {
+  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  if (designator == NULL || designator->gpio_word < 0) {
+    *red = *green = *blue = 0;
+    return false;
+  }
+  ReadLevels(bitplane_buffer_ + designator->gpio_word,
+             designator->r_bit, designator->g_bit, designator->b_bit,
+             red, green, blue);
+  return true;
+}
+
+bool Framebuffer::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) {
+  uint16_t r, g, b;
+  const bool exists = GetPixelLevels(x, y, &r, &g, &b);
+  UpdateLevelToColor();
+  *red = level_to_color_[r];
+  *green = level_to_color_[g];
+  *blue = level_to_color_[b];
+  return exists;
+}
+
+void Framebuffer::GetImage(int x, int y, int width, int height,
+                           uint8_t *rgb) {
+  if (width <= 0 || height <= 0) return;
+  UpdateLevelToColor();
+  const uint8_t black = level_to_color_[0];
+  memset(rgb, black, 3 * width * height);
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int start_x = std::max(x, 0);
+  const int end_x = std::min(x + width, mapper->width());
+  for (int row = std::max(y, 0); row < std::min(y + height, mapper->height());
+       ++row) {
+    uint8_t *const row_rgb = rgb + 3 * width * (row - y);
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(row, &run_count);
+    const PixelDesignatorRun *const runs_end = run + run_count;
+    for (/**/; run < runs_end && run->x < end_x; ++run) {
+      if (run->gpio_word < 0 || run->x + run->length <= start_x) continue;
+      const int from = std::max(start_x, run->x);
+      const int to = std::min(end_x, run->x + run->length);
+      const plane_bits_t *bits = (bitplane_buffer_ + run->gpio_word
+                                  + (from - run->x) * run->stride);
+      uint8_t *pixel = row_rgb + 3 * (from - x);
+      for (int i = from; i < to; ++i, bits += run->stride, pixel += 3) {
+        uint16_t r, g, b;
+        ReadLevels(bits, run->r_bit, run->g_bit, run->b_bit, &r, &g, &b);
+        pixel[0] = level_to_color_[r];
+        pixel[1] = level_to_color_[g];
+        pixel[2] = level_to_color_[b];
+      }
+    }
+  }
+}
+
 // Strange LED-mappings such as RBG or so are handled here.
 gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
                                                 const char *led_sequence,
@@ -594,7 +1905,7 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
 void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
                                         PixelDesignator *d) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  uint32_t *bits = ValueAt(y % double_rows_, x, 0);
+  plane_bits_t *bits = ValueAt(y % double_rows_, x, first_plane_);
   d->gpio_word = bits - bitplane_buffer_;
   d->r_bit = d->g_bit = d->b_bit = 0;
   if (y < rows_) {
@@ -631,6 +1942,9 @@ void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
     }
   }
 
+  d->r_bit = PackColorBits(d->r_bit);
+  d->g_bit = PackColorBits(d->g_bit);
+  d->b_bit = PackColorBits(d->b_bit);
   d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
 }
 
@@ -642,15 +1956,83 @@ void Framebuffer::Serialize(const char **data, size_t *len) const {
 bool Framebuffer::Deserialize(const char *data, size_t len) {
   if (len != buffer_size_) return false;
   memcpy(bitplane_buffer_, data, len);
+  std::fill(nonzero_planes_.begin(), nonzero_planes_.end(), kAllPlanes);
   return true;
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+  nonzero_planes_ = other->nonzero_planes_;
+}
+
+inline plane_bits_t *Framebuffer::OverlayMaskAt(int gpio_word) {
+  const int double_row = gpio_word / row_words_;
+  const int column = gpio_word % row_words_;
+  return &overlay_mask_[double_row * columns_ + column];
+}
+
+void Framebuffer::AllocateOverlayMask() {
+  if (overlay_mask_.empty()) overlay_mask_.resize(double_rows_ * columns_, 0);
+}
+
+void Framebuffer::SetOverlayMask(int x, int y, int width, int height,
+                                 bool visible) {
+  AllocateOverlayMask();
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int end_x = std::min(x + width, mapper->width());
+  const int end_y = std::min(y + height, mapper->height());
+  x = std::max(x, 0);
+  for (y = std::max(y, 0); y < end_y; ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+    const PixelDesignatorRun *const runs_end = run + run_count;
+    for (/**/; run < runs_end && run->x < end_x; ++run) {
+      if (run->gpio_word < 0 || run->x + run->length <= x) continue;
+      const int from = std::max(x, run->x);
+      const int count = std::min(end_x, run->x + run->length) - from;
+      const plane_bits_t pixel_bits = run->r_bit | run->g_bit | run->b_bit;
+      int word = run->gpio_word + (from - run->x) * run->stride;
+      for (int i = 0; i < count; ++i, word += run->stride) {
+        plane_bits_t *mask = OverlayMaskAt(word);
+        *mask = visible ? (*mask | pixel_bits) : (*mask & ~pixel_bits);
+      }
+    }
+  }
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
+void Framebuffer::SetOverlayMaskFromContent() {
+  AllocateOverlayMask();
+  const PixelDesignatorMap *const mapper = *shared_mapper_;
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (int y = 0; y < mapper->height(); ++y) {
+    int run_count;
+    const PixelDesignatorRun *run = mapper->GetRuns(y, &run_count);
+    const PixelDesignatorRun *const runs_end = run + run_count;
+    for (/**/; run < runs_end; ++run) {
+      if (run->gpio_word < 0) continue;
+      const plane_bits_t pixel_bits = run->r_bit | run->g_bit | run->b_bit;
+      const plane_bits_t black = inverse_color_ ? pixel_bits : 0;
+      int word = run->gpio_word;
+      for (int i = 0; i < run->length; ++i, word += run->stride) {
+        const plane_bits_t *bits = bitplane_buffer_ + word
+          + PlaneOffset(min_bit_plane);
+        bool is_black = true;
+        for (int b = min_bit_plane; b < kBitPlanes && is_black;
+             ++b, bits += columns_) {
+          is_black = ((*bits & pixel_bits) == black);
+        }
+        plane_bits_t *mask = OverlayMaskAt(word);
+        *mask = is_black ? (*mask & ~pixel_bits) : (*mask | pixel_bits);
+      }
+    }
+  }
+}
+
+void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit,
+                               const Framebuffer *fade_to,
+                               uint32_t fade_planes,
+                               const Framebuffer *overlay) {
   const struct HardwareMapping &h = *hardware_mapping_;
   gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
   color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
@@ -666,6 +2048,9 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
   // Depending if we do dithering, we might not always show the lowest bits.
   const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
 
+  if (overlay != NULL && overlay->overlay_mask_.empty())
+    overlay = NULL;  // Nothing to show.
+
   const uint8_t half_double = double_rows_/2;
   for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
     uint8_t d_row;
@@ -681,16 +2066,53 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
                : ((row_loop - half_double) << 1) + 1);
     }
 
+    // Skipping planes of rows with fewer pwm bits keeps the timing of the
+    // others, so the brightness stays the same.
+    const int row_start_bit = std::max(start_bit,
+                                       kBitPlanes - row_pwm_bits_[d_row]);
+
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
-    for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+    for (int b = row_start_bit; b < kBitPlanes; ++b) {
+      const int offset = ValueAt(d_row, 0, b) - bitplane_buffer_;
+      const plane_bits_t *row_data = ((fade_planes & (1 << b))
+                                     ? fade_to->bitplane_buffer_
+                                     : bitplane_buffer_) + offset;
+      const uint16_t planes
+        = (((fade_planes & (1 << b)) ? fade_to : this)->nonzero_planes_[d_row]
+           | (overlay ? overlay->nonzero_planes_[d_row] : 0));
       // While the output enable is still on, we can already clock in the next
       // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+      if ((planes & (1 << b)) == 0) {
+        // Nothing set in this plane: only zeros need to be in the shift
+        // registers, which might already be the case.
+        if (!sShiftRegistersZero) {
+          for (int col = 0; col < columns_; ++col) {
+            io->WriteMaskedBits(0, color_clk_mask);
+            io->SetBits(h.clock);
+          }
+          sShiftRegistersZero = true;
+        }
+      } else if (overlay == NULL) {
+        for (int col = 0; col < columns_; ++col) {
+          const plane_bits_t &out = *row_data++;
+          io->WriteMaskedBits(ExpandColorBits(out),
+                              color_clk_mask);  // col + reset clock
+          io->SetBits(h.clock);               // Rising edge: clock color in.
+        }
+        sShiftRegistersZero = false;
+      } else {
+        const plane_bits_t *overlay_data = overlay->bitplane_buffer_ + offset;
+        const plane_bits_t *mask = &overlay->overlay_mask_[d_row * columns_];
+        for (int col = 0; col < columns_; ++col) {
+          const plane_bits_t out = ((*row_data++ & ~*mask)
+                                    | (*overlay_data++ & *mask));
+          ++mask;
+          io->WriteMaskedBits(ExpandColorBits(out),
+                              color_clk_mask);  // col + reset clock
+          io->SetBits(h.clock);               // Rising edge: clock color in.
+        }
+        sShiftRegistersZero = false;
       }
       io->ClearBits(color_clk_mask);    // clock back to normal.
 
@@ -355,7 +355,7 @@ namespace {
 // Manual timers.
 class Timers {
 public:
-  static bool Init();
+  static bool Init(bool performance_governor);
   static void sleep_nanos(long t);
 };
 
@@ -375,7 +375,7 @@ public:
 
   virtual void SendPulse(int time_spec_number) {
     io_->ClearBits(bits_);
-    Timers::sleep_nanos(nano_specs_[time_spec_number]);
+    Timers::sleep_nanos(ScaledPulse(nano_specs_[time_spec_number]));
     io_->SetBits(bits_);
   }
 
@@ -425,7 +425,7 @@ static void DisableRealtimeThrottling() {
   WriteTo("/proc/sys/kernel/sched_rt_runtime_us", "-1");
 }
 
-bool Timers::Init() {
+bool Timers::Init(bool performance_governor) {
   if (!mmap_all_bcm_registers_once())
     return false;
 
@@ -438,9 +438,12 @@ bool Timers::Init() {
   }
 
   DisableRealtimeThrottling();
-  // If we have it, we run the update thread on core3. No perf-compromises:
-  WriteTo("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor",
-          "performance");
+  // If we have it, we run the update thread on core3. No perf-compromises,
+  // unless we're asked to save power.
+  if (performance_governor) {
+    WriteTo("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor",
+            "performance");
+  }
   return true;
 }
 
@@ -577,8 +580,9 @@ public:
 #endif
   }
 
-  HardwarePinPulser(uint32_t pins, const std::vector<int> &specs)
-    : triggered_(false) {
+  HardwarePinPulser(uint32_t pins, const std::vector<int> &specs,
+                    bool scalable_pulses)
+    : lsb_range_(kMinLsbRange), triggered_(false) {
     assert(CanHandle(pins));
     assert(s_CLK_registers && s_PWM_registers && s_Timer1Mhz);
 
@@ -599,10 +603,7 @@ public:
       exit(1);
     }
 
-    for (size_t i = 0; i < specs.size(); ++i) {
-      // Hints how long to nanosleep, already corrected for system overhead.
-      sleep_hints_us_.push_back(specs[i]/1000 - JitterAllowanceMicroseconds());
-    }
+    pulse_nanos_.assign(specs.begin(), specs.end());
 
     const int base = specs[0];
     // Get relevant registers
@@ -617,32 +618,53 @@ public:
     } else {
       assert(false); // should've been caught by CanHandle()
     }
-    InitPWMDivider((base/2) / PWM_BASE_TIME_NS);
+    if (scalable_pulses) {
+      // Make the shortest pulse more counts of a faster PWM clock, which
+      // leaves room to shorten it when pulses are scaled down. Scaled
+      // pulses are rounded to whole counts, with a minimum of
+      // kMinLsbRange, so they stay in proportion down to a scale of
+      // kMinLsbRange/lsb_range_.
+      while (lsb_range_ < kMaxLsbRange
+             && (base / (2 * lsb_range_)) / PWM_BASE_TIME_NS
+             >= kMinPWMDivider) {
+        lsb_range_ *= 2;
+      }
+    }
+    InitPWMDivider((base / lsb_range_) / PWM_BASE_TIME_NS);
     for (size_t i = 0; i < specs.size(); ++i) {
-      pwm_range_.push_back(2 * specs[i] / base);
+      pwm_range_.push_back(lsb_range_ * specs[i] / base);
     }
   }
 
-  virtual void SendPulse(int c) {
-    if (pwm_range_[c] < 16) {
-      s_PWM_registers[PWM_RNG1] = pwm_range_[c];
+  virtual int MinProportionalScale() const {
+    return kFullPulseScale * kMinLsbRange / lsb_range_;
+  }
 
-      *fifo_ = pwm_range_[c];
+  virtual void SendPulse(int c) {
+    uint32_t range = ScaledPulse(pwm_range_[c]);
+    // The hardware can't deal with values < 2.
+    if (range < kMinLsbRange) range = kMinLsbRange;
+    if (range < 8 * lsb_range_) {
+      // Exact length for all short pulses, which are the ones where a
+      // count more or less matters.
+      s_PWM_registers[PWM_RNG1] = range;
+
+      *fifo_ = range;
     } else {
       // Keep the actual range as short as possible, as we have to
       // wait for one full period of these in the zero phase.
-      // The hardware can't deal with values < 2, so only do this when
-      // have enough of these.
-      s_PWM_registers[PWM_RNG1] = pwm_range_[c] / 8;
-
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
+      // Rounding to a multiple of 8 is off by less than 7% here.
+      const uint32_t period = (range + 4) / 8;
+      s_PWM_registers[PWM_RNG1] = period;
+
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
+      *fifo_ = period;
     }
 
     /*
@@ -662,7 +684,9 @@ public:
      */
     *fifo_ = 0;
 
-    sleep_hint_us_ = sleep_hints_us_[c];
+    // Hint how long to nanosleep, corrected for system overhead.
+    sleep_hint_us_ = ((int)(ScaledPulse(pulse_nanos_[c]) / 1000)
+                      - (int)JitterAllowanceMicroseconds());
     start_time_ = *s_Timer1Mhz;
     triggered_ = true;
     s_PWM_registers[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_PWEN1 | PWM_CTL_POLA1;
@@ -734,8 +758,17 @@ private:
   }
 
 private:
+  // PWM clock counts of the shortest pulse: the hardware minimum, or up to
+  // kMaxLsbRange with scalable pulses.
+  enum { kMinLsbRange = 2, kMaxLsbRange = 8 };
+  // The clock manager outputs are specified for up to 125MHz; that is
+  // the 500MHz PLLD divided by 4.
+  enum { kMinPWMDivider = 4 };
+
+  uint32_t lsb_range_;
+
   std::vector<uint32_t> pwm_range_;
-  std::vector<int> sleep_hints_us_;
+  std::vector<uint32_t> pulse_nanos_;
   volatile uint32_t *fifo_;
   uint32_t start_time_;
   int sleep_hint_us_;
@@ -747,10 +780,12 @@ private:
 // Public PinPulser factory
 PinPulser *PinPulser::Create(GPIO *io, uint32_t gpio_mask,
                              bool allow_hardware_pulsing,
-                             const std::vector<int> &nano_wait_spec) {
-  if (!Timers::Init()) return NULL;
+                             const std::vector<int> &nano_wait_spec,
+                             bool performance_governor,
+                             bool scalable_pulses) {
+  if (!Timers::Init(performance_governor)) return NULL;
   if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
-    return new HardwarePinPulser(gpio_mask, nano_wait_spec);
+    return new HardwarePinPulser(gpio_mask, nano_wait_spec, scalable_pulses);
   } else {
     return new TimerBasedPinPulser(io, gpio_mask, nano_wait_spec);
   }
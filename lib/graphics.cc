@@ -14,11 +14,49 @@
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
 #include "graphics.h"
+#include "led-matrix.h"
 #include "utf8-internal.h"
 #include <stdlib.h>
+#include <algorithm>
 #include <functional>
+#include <vector>
 
 namespace rgb_matrix {
+namespace {
+// Sets pixels of one color. On a FrameCanvas or RGBMatrix, the color is
+// only converted once.
+class ColorPixelSetter {
+public:
+  ColorPixelSetter(Canvas *c, const Color &color)
+    : canvas_(c), color_(color),
+      frame_(dynamic_cast<FrameCanvas*>(c)),
+      matrix_(frame_ ? NULL : dynamic_cast<RGBMatrix*>(c)) {
+    if (frame_) {
+      frame_->PrepareColor(color.r, color.g, color.b, &prepared_);
+    } else if (matrix_) {
+      matrix_->PrepareColor(color.r, color.g, color.b, &prepared_);
+    }
+  }
+
+  void SetPixel(int x, int y) {
+    if (frame_) {
+      frame_->SetPixel(x, y, prepared_);
+    } else if (matrix_) {
+      matrix_->SetPixel(x, y, prepared_);
+    } else {
+      canvas_->SetPixel(x, y, color_.r, color_.g, color_.b);
+    }
+  }
+
+private:
+  Canvas *const canvas_;
+  const Color color_;
+  FrameCanvas *const frame_;
+  RGBMatrix *const matrix_;
+  PreparedColor prepared_;
+};
+}  // namespace
+
 int DrawText(Canvas *c, const Font &font,
              int x, int y, const Color &color,
              const char *utf8_text) {
@@ -60,18 +98,19 @@ int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
 }
 
 void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
+  ColorPixelSetter pixel(c, color);
   int x = radius, y = 0;
   int radiusError = 1 - x;
 
   while (y <= x) {
-    c->SetPixel(x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, -x + y0, color.r, color.g, color.b);
-    c->SetPixel(x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, -x + y0, color.r, color.g, color.b);
+    pixel.SetPixel(x + x0, y + y0);
+    pixel.SetPixel(y + x0, x + y0);
+    pixel.SetPixel(-x + x0, y + y0);
+    pixel.SetPixel(-y + x0, x + y0);
+    pixel.SetPixel(-x + x0, -y + y0);
+    pixel.SetPixel(-y + x0, -x + y0);
+    pixel.SetPixel(x + x0, -y + y0);
+    pixel.SetPixel(y + x0, -x + y0);
     y++;
     if (radiusError<0){
       radiusError += 2 * y + 1;
@@ -93,8 +132,14 @@ void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
     }
     gradient = (dy << shift) / dx ;
 
+    // Consecutive pixels in the same row are drawn as one span.
+    int span_start = x0;
     for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
-      c->SetPixel(x, y >> shift, color.r, color.g, color.b);
+      if (x == x1 || ((y + gradient) >> shift) != (y >> shift)) {
+        c->FillSpan(span_start, y >> shift, x - span_start + 1,
+                    color.r, color.g, color.b);
+        span_start = x + 1;
+      }
     }
   } else if (dy != 0) {
     // y variation is bigger than x variation
@@ -103,12 +148,98 @@ void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
       std::swap(y0, y1);
     }
     gradient = (dx << shift) / dy;
+    ColorPixelSetter pixel(c, color);
     for (y = y0 , x = 0x8000 + (x0 << shift); y <= y1; ++y, x += gradient) {
-      c->SetPixel(x >> shift, y, color.r, color.g, color.b);
+      pixel.SetPixel(x >> shift, y);
     }
   } else {
     c->SetPixel(x0, y0, color.r, color.g, color.b);
   }
 }
 
+void DrawHLine(Canvas *c, int x, int y, int length, const Color &color) {
+  c->FillSpan(x, y, length, color.r, color.g, color.b);
+}
+
+void DrawVLine(Canvas *c, int x, int y, int length, const Color &color) {
+  ColorPixelSetter pixel(c, color);
+  const int end_y = std::min(y + length, c->height());
+  for (y = std::max(y, 0); y < end_y; ++y) {
+    pixel.SetPixel(x, y);
+  }
+}
+
+void FillRect(Canvas *c, int x, int y, int width, int height,
+              const Color &color) {
+  const int end_y = std::min(y + height, c->height());
+  for (y = std::max(y, 0); y < end_y; ++y) {
+    c->FillSpan(x, y, width, color.r, color.g, color.b);
+  }
+}
+
+void FillCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
+  if (radius < 0) return;
+  // Same points as DrawCircle(), but we only remember how far each row
+  // extends to the left and right of the center.
+  std::vector<int> half_width(radius + 1, 0);
+  int x = radius, y = 0;
+  int radiusError = 1 - x;
+  while (y <= x) {
+    half_width[y] = std::max(half_width[y], x);
+    half_width[x] = std::max(half_width[x], y);
+    y++;
+    if (radiusError<0){
+      radiusError += 2 * y + 1;
+    } else {
+      x--;
+      radiusError+= 2 * (y - x + 1);
+    }
+  }
+  for (int dy = 0; dy <= radius; ++dy) {
+    const int w = 2 * half_width[dy] + 1;
+    c->FillSpan(x0 - half_width[dy], y0 + dy, w, color.r, color.g, color.b);
+    if (dy != 0) {
+      c->FillSpan(x0 - half_width[dy], y0 - dy, w, color.r, color.g, color.b);
+    }
+  }
+}
+
+void FillPolygon(Canvas *c, const int *xs, const int *ys, int count,
+                 const Color &color) {
+  if (count < 3) return;
+  int min_y = ys[0], max_y = ys[0];
+  for (int i = 1; i < count; ++i) {
+    min_y = std::min(min_y, ys[i]);
+    max_y = std::max(max_y, ys[i]);
+  }
+  min_y = std::max(min_y, 0);
+  max_y = std::min(max_y, c->height() - 1);
+
+  // Positions in x where edges cross the current row in 16.16 fixed point.
+  std::vector<int64_t> crossings;
+  for (int y = min_y; y <= max_y; ++y) {
+    // We sample at the center of the pixel. To stay in integers, all
+    // y-coordinates are doubled.
+    const int64_t sample_y = 2 * y + 1;
+    crossings.clear();
+    for (int i = 0, j = count - 1; i < count; j = i++) {
+      const int64_t ya = 2 * (int64_t)ys[j], yb = 2 * (int64_t)ys[i];
+      if ((ya <= sample_y) == (yb <= sample_y))
+        continue;  // Edge doesn't cross this row.
+      const int64_t xa = xs[j], xb = xs[i];
+      crossings.push_back(xa * 65536
+                          + (sample_y - ya) * (xb - xa) * 65536 / (yb - ya));
+    }
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+      // Pixels whose center is in [crossings[i], crossings[i+1]).
+      const int64_t start = (crossings[i] - 0x8000 + 0xffff) >> 16;
+      const int64_t end = (crossings[i+1] - 0x8000 + 0xffff) >> 16;
+      if (end > start) {
+        c->FillSpan(start, y, end - start, color.r, color.g, color.b);
+      }
+    }
+  }
+}
+
 }//namespace
@@ -73,16 +73,23 @@ struct RGBLedMatrix *led_matrix_create_from_options(
     OPT_COPY_IF_SET(pwm_bits);
     OPT_COPY_IF_SET(pwm_lsb_nanoseconds);
     OPT_COPY_IF_SET(pwm_dither_bits);
+    OPT_COPY_IF_SET(dither);
+    OPT_COPY_IF_SET(idle_refresh_hz);
     OPT_COPY_IF_SET(brightness);
     OPT_COPY_IF_SET(scan_mode);
     OPT_COPY_IF_SET(row_address_type);
     OPT_COPY_IF_SET(multiplexing);
+    OPT_COPY_IF_SET(multiplexing_name);
     OPT_COPY_IF_SET(disable_hardware_pulsing);
     OPT_COPY_IF_SET(show_refresh_rate);
     OPT_COPY_IF_SET(inverse_colors);
+    OPT_COPY_IF_SET(pulse_brightness);
+    OPT_COPY_IF_SET(low_power_idle);
+    OPT_COPY_IF_SET(huge_pages);
     OPT_COPY_IF_SET(led_rgb_sequence);
     OPT_COPY_IF_SET(pixel_mapper_config);
     OPT_COPY_IF_SET(panel_type);
+    OPT_COPY_IF_SET(pixel_mapping_cache);
 #undef OPT_COPY_IF_SET
   }
 
@@ -105,16 +112,23 @@ struct RGBLedMatrix *led_matrix_create_from_options(
     ACTUAL_VALUE_BACK_TO_OPT(pwm_bits);
     ACTUAL_VALUE_BACK_TO_OPT(pwm_lsb_nanoseconds);
     ACTUAL_VALUE_BACK_TO_OPT(pwm_dither_bits);
+    ACTUAL_VALUE_BACK_TO_OPT(dither);
+    ACTUAL_VALUE_BACK_TO_OPT(idle_refresh_hz);
     ACTUAL_VALUE_BACK_TO_OPT(brightness);
     ACTUAL_VALUE_BACK_TO_OPT(scan_mode);
     ACTUAL_VALUE_BACK_TO_OPT(row_address_type);
     ACTUAL_VALUE_BACK_TO_OPT(multiplexing);
+    ACTUAL_VALUE_BACK_TO_OPT(multiplexing_name);
     ACTUAL_VALUE_BACK_TO_OPT(disable_hardware_pulsing);
     ACTUAL_VALUE_BACK_TO_OPT(show_refresh_rate);
     ACTUAL_VALUE_BACK_TO_OPT(inverse_colors);
+    ACTUAL_VALUE_BACK_TO_OPT(pulse_brightness);
+    ACTUAL_VALUE_BACK_TO_OPT(low_power_idle);
+    ACTUAL_VALUE_BACK_TO_OPT(huge_pages);
     ACTUAL_VALUE_BACK_TO_OPT(led_rgb_sequence);
     ACTUAL_VALUE_BACK_TO_OPT(pixel_mapper_config);
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
+    ACTUAL_VALUE_BACK_TO_OPT(pixel_mapping_cache);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -157,6 +171,34 @@ struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+struct LedCanvas *led_matrix_acquire_canvas(struct RGBLedMatrix *matrix) {
+  return from_canvas(to_matrix(matrix)->AcquireFrameCanvas());
+}
+
+int led_matrix_release_canvas(struct RGBLedMatrix *matrix,
+                              struct LedCanvas *canvas) {
+  return to_matrix(matrix)->ReleaseFrameCanvas(to_canvas(canvas));
+}
+
+void led_matrix_set_overlay(struct RGBLedMatrix *matrix,
+                            struct LedCanvas *overlay) {
+  to_matrix(matrix)->SetOverlay(to_canvas(overlay));
+}
+
+void led_canvas_set_overlay_mask(struct LedCanvas *canvas, int x, int y,
+                                 int width, int height, int visible) {
+  to_canvas(canvas)->SetOverlayMask(x, y, width, height, visible != 0);
+}
+
+struct LedCanvas *led_matrix_cross_fade(struct RGBLedMatrix *matrix,
+                                        struct LedCanvas *from,
+                                        struct LedCanvas *to,
+                                        uint32_t duration_us) {
+  return from_canvas(to_matrix(matrix)->CrossFade(to_canvas(from),
+                                                  to_canvas(to),
+                                                  duration_us));
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -179,6 +221,50 @@ void led_canvas_set_pixel(struct LedCanvas *canvas, int x, int y,
   to_canvas(canvas)->SetPixel(x, y, r, g, b);
 }
 
+// struct LedPixel has the same layout as rgb_matrix::Pixel.
+void led_canvas_set_pixels(struct LedCanvas *canvas,
+                           const struct LedPixel *pixels, int count) {
+  to_canvas(canvas)->SetPixels(
+    reinterpret_cast<const rgb_matrix::Pixel*>(pixels), count);
+}
+
+void led_canvas_set_row(struct LedCanvas *canvas, int x, int y, int length,
+                        const uint8_t *rgb) {
+  to_canvas(canvas)->SetRow(x, y, length, rgb);
+}
+
+int led_canvas_set_row_pwm_bits(struct LedCanvas *canvas, int y, int height,
+                                uint8_t value) {
+  return to_canvas(canvas)->SetRowPWMBits(y, height, value);
+}
+
+void led_canvas_set_dither(struct LedCanvas *canvas, int mode,
+                           unsigned phase) {
+  to_canvas(canvas)->SetDither(mode);
+  to_canvas(canvas)->SetDitherPhase(phase);
+}
+
+void led_canvas_set_palette_color(struct LedCanvas *canvas, uint8_t index,
+                                  uint8_t r, uint8_t g, uint8_t b,
+                                  int recolor) {
+  to_canvas(canvas)->SetPaletteColor(index, r, g, b, recolor != 0);
+}
+
+void led_canvas_set_indexed_row(struct LedCanvas *canvas, int x, int y,
+                                int length, const uint8_t *indices) {
+  to_canvas(canvas)->SetIndexedRow(x, y, length, indices);
+}
+
+int led_canvas_get_pixel(struct LedCanvas *canvas, int x, int y,
+                         uint8_t *r, uint8_t *g, uint8_t *b) {
+  return to_canvas(canvas)->GetPixel(x, y, r, g, b);
+}
+
+void led_canvas_get_image(struct LedCanvas *canvas, int x, int y,
+                          int width, int height, uint8_t *rgb) {
+  to_canvas(canvas)->GetImage(x, y, width, height, rgb);
+}
+
 void led_canvas_clear(struct LedCanvas *canvas) {
   to_canvas(canvas)->Clear();
 }
@@ -239,3 +325,21 @@ void draw_line(struct LedCanvas *c, int x0, int y0, int x1, int y1, uint8_t r, u
 	const rgb_matrix::Color col = rgb_matrix::Color(r, g, b);
 	DrawLine(to_canvas(c), x0, y0, x1, y1, col);
 }
+
+// Fill rectangle with the top left corner "x", "y" of the given size.
+void fill_rect(struct LedCanvas *c, int x, int y, int width, int height, uint8_t r, uint8_t g, uint8_t b) {
+	const rgb_matrix::Color col = rgb_matrix::Color(r, g, b);
+	FillRect(to_canvas(c), x, y, width, height, col);
+}
+
+// Fill circle centered at "x", "y", with a radius of "radius".
+void fill_circle(struct LedCanvas *c, int x, int y, int radius, uint8_t r, uint8_t g, uint8_t b) {
+	const rgb_matrix::Color col = rgb_matrix::Color(r, g, b);
+	FillCircle(to_canvas(c), x, y, radius, col);
+}
+
+// Fill polygon with "count" corners at "xs[i]", "ys[i]".
+void fill_polygon(struct LedCanvas *c, const int *xs, const int *ys, int count, uint8_t r, uint8_t g, uint8_t b) {
+	const rgb_matrix::Color col = rgb_matrix::Color(r, g, b);
+	FillPolygon(to_canvas(c), xs, ys, count, col);
+}
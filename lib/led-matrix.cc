@@ -21,9 +21,15 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
 
 #include "gpio.h"
 #include "thread.h"
@@ -49,16 +55,28 @@
 namespace rgb_matrix {
 using namespace internal;
 
+// The CPU the refresh thread is tied to, if there is one (see StartRefresh()).
+static const int kRefreshCpu = 3;
+
 // Pump pixels to screen. Needs to be high priority real-time because jitter
 class RGBMatrix::UpdateThread : public Thread {
 public:
   UpdateThread(GPIO *io, FrameCanvas *initial_frame,
-               int pwm_dither_bits, bool show_refresh)
-    : io_(io), show_refresh_(show_refresh), running_(true),
-      current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+               int pwm_dither_bits, bool show_refresh,
+               bool low_power_idle, int idle_refresh_hz)
+    : io_(io), show_refresh_(show_refresh),
+      low_power_idle_(low_power_idle), idle_refresh_hz_(idle_refresh_hz),
+      running_(true),
+      current_frame_(initial_frame), next_frame_(NULL), changed_(false),
+      requested_frame_multiple_(1),
+      replace_frames_(NULL), replace_buffers_(NULL),
+      replace_mapper_(NULL), new_mapper_(NULL),
+      fade_from_(NULL), fade_to_(NULL), fade_duration_us_(0),
+      fade_start_us_(0), fade_started_(false), overlay_(NULL),
+      overlay_changed_(false) {
     pthread_cond_init(&frame_done_, NULL);
     pthread_cond_init(&input_change_, NULL);
+    pthread_cond_init(&wakeup_, NULL);
     switch (pwm_dither_bits) {
     case 0:
       start_bit_[0] = 0; start_bit_[1] = 0;
@@ -76,8 +94,12 @@ public:
   }
 
   void Stop() {
-    MutexLock l(&running_mutex_);
-    running_ = false;
+    {
+      MutexLock l(&running_mutex_);
+      running_ = false;
+    }
+    MutexLock l(&frame_sync_);
+    pthread_cond_signal(&wakeup_);  // In case we're idle.
   }
 
   virtual void Run() {
@@ -92,11 +114,22 @@ public:
     uint32_t initial_holdoff_start = GetMicrosecondCounter();
     bool max_measure_enabled = false;
 
+    // While cross-fading: the frame to fade to and the bitplanes to show
+    // from it.
+    const Framebuffer *fade_frame = NULL;
+    uint32_t fade_planes = 0;
+    const Framebuffer *overlay = NULL;
+
+    // Time of the last change of what is shown, to find static content.
+    uint32_t last_change_us = initial_holdoff_start;
+    bool content_static = false;
+
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
       current_frame_->framebuffer()
-        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
+        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4],
+                       fade_frame, fade_planes, overlay);
 
       // SwapOnVSync() exchange.
       {
@@ -113,17 +146,69 @@ public:
           }
           pthread_cond_signal(&frame_done_);
         }
-      }
+        if (replace_frames_ != NULL) {
+          for (size_t i = 0; i < replace_frames_->size(); ++i) {
+            (*replace_buffers_)[i] = (*replace_frames_)[i]
+              ->ReplaceBitplaneBuffer((*replace_buffers_)[i]);
+          }
+          *replace_mapper_ = new_mapper_;
+          replace_frames_ = NULL;
+          replace_buffers_ = NULL;
+          pthread_cond_broadcast(&frame_done_);
+        }
+        fade_frame = NULL;
+        fade_planes = 0;
+        if (fade_to_ != NULL) {
+          if (NextCrossFadePlanes(&fade_planes)) {
+            fade_frame = fade_to_->framebuffer();
+          } else {
+            current_frame_ = fade_to_;
+            fade_from_ = NULL;
+            fade_to_ = NULL;
+            pthread_cond_broadcast(&frame_done_);
+          }
+        }
+        overlay = overlay_ ? overlay_->framebuffer() : NULL;
+        if (overlay_changed_) {
+          overlay_changed_ = false;
+          pthread_cond_broadcast(&frame_done_);
+        }
+        if (changed_ || fade_to_ != NULL) {
+          changed_ = false;
+          last_change_us = start_time_us;
+          content_static = false;
+        }
 
-      // Read input bits.
-      const uint32_t inputs = io_->Read();
-      if (inputs != last_gpio_bits) {
-        last_gpio_bits = inputs;
-        MutexLock l(&input_sync_);
-        gpio_inputs_ = inputs;
-        pthread_cond_signal(&input_change_);
+        if (low_power_idle_) {
+          // Rather than refreshing black, wait until there is something to
+          // show. Pixels drawn directly on the shown frame are picked up by
+          // polling.
+          while (ShowsNothing() && running()) {
+            frame_sync_.WaitOn(&wakeup_, kIdlePollMs);
+            ReadInputs(&last_gpio_bits);
+          }
+        }
+
+        if (idle_refresh_hz_ > 0) {
+          // For static content, wait out the rest of the slower refresh
+          // period unless there is a change.
+          const uint32_t period_us = 1000000 / idle_refresh_hz_;
+          uint32_t now = GetMicrosecondCounter();
+          content_static = (content_static
+                            || now - last_change_us > kStaticHoldoffUs);
+          while (content_static && !ChangePending()
+                 && now - start_time_us < period_us && running()) {
+            const int remaining_ms = (period_us - (now - start_time_us)) / 1000;
+            frame_sync_.WaitOn(&wakeup_,
+                               std::min(remaining_ms + 1, (int)kIdlePollMs));
+            ReadInputs(&last_gpio_bits);
+            now = GetMicrosecondCounter();
+          }
+        }
       }
 
+      ReadInputs(&last_gpio_bits);
+
       ++frame_count;
       ++low_bit_sequence;
 
@@ -151,10 +236,70 @@ public:
     FrameCanvas *previous = current_frame_;
     next_frame_ = other;
     requested_frame_multiple_ = frame_fraction;
+    changed_ = true;
+    pthread_cond_signal(&wakeup_);
     frame_sync_.WaitOn(&frame_done_);
     return previous;
   }
 
+  // Replace the bitplane buffers of "frames" with "buffers" and set
+  // "*mapper" to "new_mapper" at the next VSync, so that the buffers never
+  // are in a different layout than the mapping. The previous buffers are
+  // returned in "buffers".
+  void ReplaceBuffersOnVSync(const std::vector<Framebuffer*> &frames,
+                             std::vector<plane_bits_t*> *buffers,
+                             PixelDesignatorMap **mapper,
+                             PixelDesignatorMap *new_mapper) {
+    MutexLock l(&frame_sync_);
+    replace_frames_ = &frames;
+    replace_buffers_ = buffers;
+    replace_mapper_ = mapper;
+    new_mapper_ = new_mapper;
+    changed_ = true;
+    pthread_cond_signal(&wakeup_);
+    while (replace_frames_ != NULL) {
+      frame_sync_.WaitOn(&frame_done_);
+    }
+  }
+
+  // Show "from" and blend over to "to" in "duration_us". Returns the frame
+  // shown before, once "to" is shown exclusively.
+  FrameCanvas *CrossFade(FrameCanvas *from, FrameCanvas *to,
+                         uint32_t duration_us) {
+    MutexLock l(&frame_sync_);
+    FrameCanvas *previous = current_frame_;
+    fade_from_ = (from != NULL) ? from : current_frame_;
+    fade_to_ = to;
+    fade_duration_us_ = duration_us;
+    fade_started_ = false;
+    changed_ = true;
+    pthread_cond_signal(&wakeup_);
+    while (fade_to_ != NULL) {
+      frame_sync_.WaitOn(&frame_done_);
+    }
+    return previous;
+  }
+
+  // If "frame" is shown or about to be shown in any way.
+  bool IsInUse(const FrameCanvas *frame) {
+    MutexLock l(&frame_sync_);
+    return (frame == current_frame_ || frame == next_frame_
+            || frame == fade_from_ || frame == fade_to_ || frame == overlay_);
+  }
+
+  // Show "overlay" on top, starting with the next refresh. Returns once the
+  // refresh loop uses it, so a previous overlay is not accessed anymore.
+  void SetOverlay(FrameCanvas *overlay) {
+    MutexLock l(&frame_sync_);
+    overlay_ = overlay;
+    overlay_changed_ = true;
+    changed_ = true;
+    pthread_cond_signal(&wakeup_);
+    while (overlay_changed_) {
+      frame_sync_.WaitOn(&frame_done_);
+    }
+  }
+
   uint32_t AwaitInputChange(int timeout_ms) {
     MutexLock l(&input_sync_);
     input_sync_.WaitOn(&input_change_, timeout_ms);
@@ -162,13 +307,77 @@ public:
   }
 
 private:
+  // While not refreshing, polling interval for new content on a black frame
+  // and for input changes.
+  static const int kIdlePollMs = 20;
+  // Time after the last change after which content is considered static.
+  static const uint32_t kStaticHoldoffUs = 1000 * 1000;
+
   inline bool running() {
     MutexLock l(&running_mutex_);
     return running_;
   }
 
+  // Read the input bits and wake up AwaitInputChange() if they changed
+  // from "last_gpio_bits".
+  void ReadInputs(uint32_t *last_gpio_bits) {
+    const uint32_t inputs = io_->Read();
+    if (inputs != *last_gpio_bits) {
+      *last_gpio_bits = inputs;
+      MutexLock l(&input_sync_);
+      gpio_inputs_ = inputs;
+      pthread_cond_signal(&input_change_);
+    }
+  }
+
+  // Needs frame_sync_ held.
+  bool ChangePending() const {
+    return changed_ || next_frame_ != NULL || replace_frames_ != NULL
+      || fade_to_ != NULL;
+  }
+
+  // If nothing but black is to be shown. Needs frame_sync_ held.
+  bool ShowsNothing() const {
+    return !ChangePending() && current_frame_->framebuffer()->IsBlank()
+      && (overlay_ == NULL || overlay_->framebuffer()->IsBlank());
+  }
+
+  // Determine which bitplanes of the next refresh to take from fade_to_.
+  // Each bitplane individually shows fade_to_ in a fraction of the refreshes
+  // that grows with the progress of the fade, so on average, each pixel is
+  // the weighted sum of both frames. The bitplanes start with different
+  // phases, so the most significant ones rarely switch at the same time,
+  // which reduces flicker.
+  // Returns false once the fade is done. Needs frame_sync_ held.
+  bool NextCrossFadePlanes(uint32_t *planes) {
+    const uint32_t now = GetMicrosecondCounter();
+    if (!fade_started_) {
+      current_frame_ = fade_from_;
+      fade_start_us_ = now;
+      fade_started_ = true;
+      for (int b = 0; b < kBitPlanes; ++b) {
+        fade_error_[b] = (b * 40503) & 0xffff;  // golden ratio phases.
+      }
+    }
+    const uint32_t elapsed = now - fade_start_us_;
+    if (elapsed >= fade_duration_us_)
+      return false;
+    const uint32_t weight = ((uint64_t)elapsed << 16) / fade_duration_us_;
+    *planes = 0;
+    for (int b = 0; b < kBitPlanes; ++b) {
+      fade_error_[b] += weight;
+      if (fade_error_[b] >= (1 << 16)) {
+        fade_error_[b] -= (1 << 16);
+        *planes |= (1 << b);
+      }
+    }
+    return true;
+  }
+
   GPIO *const io_;
   const bool show_refresh_;
+  const bool low_power_idle_;
+  const int idle_refresh_hz_;
   uint32_t start_bit_[4];
 
   Mutex running_mutex_;
@@ -182,7 +391,141 @@ private:
   pthread_cond_t frame_done_;
   FrameCanvas *current_frame_;
   FrameCanvas *next_frame_;
+  bool changed_;              // Anything new to show since the last refresh.
+  pthread_cond_t wakeup_;     // Signaled on changes, to end idle waits.
   unsigned requested_frame_multiple_;
+  const std::vector<Framebuffer*> *replace_frames_;
+  std::vector<plane_bits_t*> *replace_buffers_;
+  PixelDesignatorMap **replace_mapper_;   // Set to new_mapper_ with them.
+  PixelDesignatorMap *new_mapper_;
+
+  FrameCanvas *fade_from_;
+  FrameCanvas *fade_to_;      // Non-NULL while cross-fading.
+  uint32_t fade_duration_us_;
+  uint32_t fade_start_us_;
+  bool fade_started_;
+  uint32_t fade_error_[kBitPlanes];  // Per bitplane, 16 bit fraction.
+
+  FrameCanvas *overlay_;
+  bool overlay_changed_;      // overlay_ not yet picked up by the refresh.
+};
+
+// Converts rows of RGB content to bitplanes with a pool of worker threads.
+// The rows are split into groups that don't share any bitplane words (see
+// Framebuffer::GetRowGroups()), so that groups can be converted in parallel
+// without locking, whatever the pixel mapping is.
+class RGBMatrix::RowConverter {
+public:
+  RowConverter(int threads, uint32_t cpu_affinity_mask)
+    : running_(true), group_count_(-1), frame_(NULL), rgb_(NULL), width_(0),
+      next_job_(0), busy_(0) {
+    pthread_cond_init(&work_available_, NULL);
+    pthread_cond_init(&work_done_, NULL);
+    for (int i = 0; i < threads; ++i) {
+      Worker *worker = new Worker(this);
+      worker->Start(0, cpu_affinity_mask);
+      workers_.push_back(worker);
+    }
+  }
+
+  ~RowConverter() {
+    {
+      MutexLock l(&mutex_);
+      running_ = false;
+      pthread_cond_broadcast(&work_available_);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      delete workers_[i];  // Waits for the thread to finish.
+    }
+    pthread_cond_destroy(&work_available_);
+    pthread_cond_destroy(&work_done_);
+  }
+
+  // The pixel mapping changed, so the row groups need to be determined again.
+  void ResetRowGroups() { group_count_ = -1; }
+
+  // Convert "rows" of "rgb" (three bytes per pixel, "width" pixels per row)
+  // into "frame". Returns when all are done.
+  void Convert(Framebuffer *frame, const uint8_t *rgb, int width,
+               const std::vector<int> &rows) {
+    if (group_count_ < 0) {
+      group_count_ = frame->GetRowGroups(&group_of_row_);
+      group_rows_.resize(group_count_);
+    }
+    for (int g = 0; g < group_count_; ++g) group_rows_[g].clear();
+    for (size_t i = 0; i < rows.size(); ++i) {
+      if (rows[i] >= (int)group_of_row_.size()) continue;
+      const int group = group_of_row_[rows[i]];
+      if (group >= 0) group_rows_[group].push_back(rows[i]);
+    }
+
+    MutexLock l(&mutex_);
+    frame_ = frame;
+    rgb_ = rgb;
+    width_ = width;
+    jobs_.clear();
+    for (int g = 0; g < group_count_; ++g) {
+      if (!group_rows_[g].empty()) jobs_.push_back(&group_rows_[g]);
+    }
+    next_job_ = 0;
+    if (jobs_.size() > 1) pthread_cond_broadcast(&work_available_);
+    ConvertJobs();  // Help out while waiting.
+    while (busy_ > 0) mutex_.WaitOn(&work_done_);
+    jobs_.clear();
+  }
+
+private:
+  class Worker : public Thread {
+  public:
+    Worker(RowConverter *converter) : converter_(converter) {}
+    virtual void Run() { converter_->WorkerLoop(); }
+
+  private:
+    RowConverter *const converter_;
+  };
+
+  void WorkerLoop() {
+    MutexLock l(&mutex_);
+    while (running_) {
+      ConvertJobs();
+      mutex_.WaitOn(&work_available_);
+    }
+  }
+
+  // Take jobs and convert their rows until there are none left. Called
+  // with mutex_ held, which is released while converting.
+  void ConvertJobs() {
+    while (next_job_ < jobs_.size()) {
+      const std::vector<int> &rows = *jobs_[next_job_++];
+      ++busy_;
+      mutex_.Unlock();
+      for (size_t i = 0; i < rows.size(); ++i) {
+        frame_->SetRow(0, rows[i], width_, rgb_ + 3 * rows[i] * width_);
+      }
+      mutex_.Lock();
+      if (--busy_ == 0 && next_job_ == jobs_.size()) {
+        pthread_cond_signal(&work_done_);
+      }
+    }
+  }
+
+  std::vector<Worker*> workers_;
+  Mutex mutex_;
+  pthread_cond_t work_available_;
+  pthread_cond_t work_done_;
+  bool running_;
+
+  int group_count_;  // -1: needs to be determined.
+  std::vector<int> group_of_row_;
+  std::vector<std::vector<int> > group_rows_;
+
+  // Current conversion, guarded by mutex_.
+  Framebuffer *frame_;
+  const uint8_t *rgb_;
+  int width_;
+  std::vector<const std::vector<int>*> jobs_;
+  size_t next_job_;
+  int busy_;  // Jobs taken, but not done yet.
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -205,6 +548,8 @@ RGBMatrix::Options::Options() :
 #endif
 
   pwm_dither_bits(0),
+  dither(0),
+  idle_refresh_hz(0),
   brightness(100),
 
 #ifdef RGB_SCAN_INTERLACED
@@ -215,6 +560,7 @@ RGBMatrix::Options::Options() :
 
   row_address_type(0),
   multiplexing(0),
+  multiplexing_name(NULL),
 
 #ifdef DISABLE_HARDWARE_PULSES
     disable_hardware_pulsing(true),
@@ -233,21 +579,94 @@ RGBMatrix::Options::Options() :
 #else
     inverse_colors(false),
 #endif
+  pulse_brightness(false),
+  low_power_idle(false),
+  huge_pages(false),
   led_rgb_sequence("RGB"),
   pixel_mapper_config(NULL),
-  panel_type(NULL)
+  panel_type(NULL),
+  pixel_mapping_cache(NULL)
 {
   // Nothing to see here.
 }
 
+namespace {
+// The "File" pixel mapper reads the mapping from a file, so the mapping
+// changes with that file. Describe each such file in "pixel_mapper_config"
+// by its size and modification time.
+std::string MappingFileStamps(const char *pixel_mapper_config) {
+  std::string result;
+  if (pixel_mapper_config == NULL) return result;
+  const std::string config = pixel_mapper_config;
+  size_t start = 0;
+  while (start < config.length()) {
+    size_t end = config.find(';', start);
+    if (end == std::string::npos) end = config.length();
+    const std::string mapper = config.substr(start, end - start);
+    start = end + 1;
+    if (mapper.length() < 5 || strncasecmp(mapper.c_str(), "file:", 5) != 0)
+      continue;
+    const std::string filename = mapper.substr(5);
+    struct stat s;
+    char stamp[64];
+    if (stat(filename.c_str(), &s) == 0) {
+      snprintf(stamp, sizeof(stamp), ":%lld:%lld",
+               (long long)s.st_size, (long long)s.st_mtime);
+    } else {
+      snprintf(stamp, sizeof(stamp), ":missing");
+    }
+    result += ";file=" + filename + stamp;
+  }
+  return result;
+}
+
+// Everything the final pixel mapping depends on. Bump the version whenever
+// the PixelDesignator or its computation changes.
+std::string PixelMappingCacheKey(const RGBMatrix::Options &o,
+                                 int stored_planes) {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "v2;hw=%s;rows=%d;cols=%d;chain=%d;parallel=%d;mux=%d;seq=%s;"
+           "planes=%d;word=%d;",
+           o.hardware_mapping ? o.hardware_mapping : "",
+           o.rows, o.cols, o.chain_length, o.parallel, o.multiplexing,
+           o.led_rgb_sequence ? o.led_rgb_sequence : "",
+           stored_planes, BITPLANE_WORD_BITS);
+  return std::string(buffer)
+    + "muxname=" + (o.multiplexing_name ? o.multiplexing_name : "")
+    + ";mapper=" + (o.pixel_mapper_config ? o.pixel_mapper_config : "")
+    + MappingFileStamps(o.pixel_mapper_config);
+}
+
+// The key can be long and contain arbitrary characters, so the filename
+// is derived from a hash of it. The full key is stored in the file and
+// compared on load.
+std::string PixelMappingCacheFile(const char *dir, const std::string &key) {
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (size_t i = 0; i < key.length(); ++i) {
+    hash = (hash ^ (uint8_t)key[i]) * 0x100000001b3ULL;
+  }
+  char filename[32];
+  snprintf(filename, sizeof(filename), "/rgbmatrix-%016llx.map",
+           (unsigned long long)hash);
+  return std::string(dir) + filename;
+}
+}  // anonymous namespace
+
 RGBMatrix::RGBMatrix(GPIO *io, const Options &options)
-  : params_(options), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL) {
+  : params_(options), pulse_color_brightness_(100),
+    io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL),
+    stored_planes_(Framebuffer::StoredPlanes(params_.pwm_bits)),
+    canvas_pool_size_(4), row_converter_(NULL) {
   assert(params_.Validate(NULL));
   const MultiplexMapper *multiplex_mapper = NULL;
-  if (params_.multiplexing > 0) {
+  if (params_.multiplexing_name && *params_.multiplexing_name) {
+    std::string err;
+    multiplex_mapper = FindMultiplexMapper(params_.multiplexing_name, &err);
+    if (multiplex_mapper == NULL) fprintf(stderr, "%s", err.c_str());
+  } else if (params_.multiplexing > 0) {
     const MuxMapperList &multiplexers = GetRegisteredMultiplexMappers();
     if (params_.multiplexing <= (int) multiplexers.size()) {
-      // TODO: we could also do a find-by-name here, but not sure if worthwhile
       multiplex_mapper = multiplexers[params_.multiplexing - 1];
     }
   }
@@ -264,17 +683,60 @@ RGBMatrix::RGBMatrix(GPIO *io, const Options &options)
   Clear();
   SetGPIO(io, true);
 
-  // We need to apply the mapping for the panels first.
-  ApplyPixelMapper(multiplex_mapper);
+  const bool use_cache = (options.pixel_mapping_cache != NULL
+                          && strlen(options.pixel_mapping_cache) > 0);
+  const std::string cache_key = PixelMappingCacheKey(options, stored_planes_);
+  const std::string cache_file = use_cache
+    ? PixelMappingCacheFile(options.pixel_mapping_cache, cache_key)
+    : "";
+  PixelDesignatorMap *cached_map = NULL;
+  if (use_cache) {
+    // A buffer of one column and one plane has one element per double row.
+    const int double_rows = Framebuffer::BufferElements(params_.rows, 1, 1);
+    cached_map = PixelDesignatorMap::LoadFromFile(
+      cache_file.c_str(), cache_key.c_str(), *shared_pixel_mapper_,
+      double_rows, stored_planes_);
+  }
+
+  if (cached_map) {
+    delete shared_pixel_mapper_;
+    shared_pixel_mapper_ = cached_map;
+  } else {
+    // We need to apply the mapping for the panels first.
+    ApplyPixelMapper(multiplex_mapper);
+
+    // .. followed by higher level mappers that might arrange panels.
+    ApplyNamedPixelMappers(options.pixel_mapper_config,
+                           params_.chain_length, params_.parallel);
+
+    if (use_cache &&
+        !shared_pixel_mapper_->SaveToFile(cache_file.c_str(),
+                                          cache_key.c_str())) {
+      fprintf(stderr, "Could not write pixel mapping cache %s\n",
+              cache_file.c_str());
+    }
+  }
 
-  // .. followed by higher level mappers that might arrange panels.
-  ApplyNamedPixelMappers(options.pixel_mapper_config,
-                         params_.chain_length, params_.parallel);
+  if (params_.show_refresh_rate) {
+    // Let the user know how well the final mapping can be used by bulk
+    // writers: the fewer runs per pixel, the better.
+    const PixelDesignatorMap::RunStatistics stats
+      = shared_pixel_mapper_->GetRunStatistics();
+    fprintf(stderr, "Pixel mapping %dx%d: %d runs for %d used pixels "
+            "(%.1f pixels/run, longest %d).\n",
+            shared_pixel_mapper_->width(), shared_pixel_mapper_->height(),
+            stats.runs, stats.pixels - stats.unused_pixels,
+            stats.runs ? (float)(stats.pixels - stats.unused_pixels) / stats.runs
+            : 0.0f, stats.longest_run);
+  }
 }
 
 RGBMatrix::RGBMatrix(GPIO *io, int rows, int chained_displays,
                      int parallel_displays)
-  : params_(Options()), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL) {
+  : params_(Options()), pulse_color_brightness_(100),
+    io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL),
+    stored_planes_(Framebuffer::StoredPlanes(params_.pwm_bits)),
+    canvas_pool_size_(4), row_converter_(NULL) {
   params_.rows = rows;
   params_.chain_length = chained_displays;
   params_.parallel = parallel_displays;
@@ -291,6 +753,7 @@ RGBMatrix::~RGBMatrix() {
     updater_->WaitStopped();
   }
   delete updater_;
+  delete row_converter_;
 
   // Make sure LEDs are off.
   active_->Clear();
@@ -299,7 +762,15 @@ RGBMatrix::~RGBMatrix() {
   for (size_t i = 0; i < created_frames_.size(); ++i) {
     delete created_frames_[i];
   }
-  delete shared_pixel_mapper_;
+  for (size_t i = 0; i < created_rgb_frames_.size(); ++i) {
+    delete created_rgb_frames_[i];
+  }
+  if (pixel_mappings_.empty()) {
+    delete shared_pixel_mapper_;
+  }
+  for (size_t i = 0; i < pixel_mappings_.size(); ++i) {
+    delete pixel_mappings_[i];
+  }
 }
 
 void RGBMatrix::ApplyNamedPixelMappers(const char *pixel_mapper_config,
@@ -333,8 +804,11 @@ void RGBMatrix::SetGPIO(GPIO *io, bool start_thread) {
     Framebuffer::InitGPIO(io_, params_.rows, params_.parallel,
                           !params_.disable_hardware_pulsing,
                           params_.pwm_lsb_nanoseconds, params_.pwm_dither_bits,
-                          params_.row_address_type);
+                          params_.row_address_type,
+                          !params_.low_power_idle,
+                          params_.pulse_brightness);
     Framebuffer::InitializePanels(io_, params_.panel_type, params_.cols);
+    ApplyPulseBrightness();
   }
   if (start_thread) {
     StartRefresh();
@@ -344,7 +818,9 @@ void RGBMatrix::SetGPIO(GPIO *io, bool start_thread) {
 bool RGBMatrix::StartRefresh() {
   if (updater_ == NULL && io_ != NULL) {
     updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
-                                params_.show_refresh_rate);
+                                params_.show_refresh_rate,
+                                params_.low_power_idle,
+                                params_.idle_refresh_hz);
     // If we have multiple processors, the kernel
     // jumps around between these, creating some global flicker.
     // So let's tie it to the last CPU available.
@@ -352,7 +828,7 @@ bool RGBMatrix::StartRefresh() {
     //   core #3 will succeed.
     // The Raspberry Pi1 only has one core, so this affinity
     //   call will simply fail and we keep using the only core.
-    updater_->Start(99, (1<<3));  // Prio: high. Also: put on last CPU.
+    updater_->Start(99, (1<<kRefreshCpu));  // Prio: high. Also: last CPU.
   }
   return updater_ != NULL;
 }
@@ -362,23 +838,66 @@ FrameCanvas *RGBMatrix::CreateFrameCanvas() {
     new FrameCanvas(new Framebuffer(params_.rows,
                                     params_.cols * params_.chain_length,
                                     params_.parallel,
+                                    stored_planes_,
                                     params_.scan_mode,
                                     params_.led_rgb_sequence,
                                     params_.inverse_colors,
+                                    params_.huge_pages,
                                     &shared_pixel_mapper_));
   if (created_frames_.empty()) {
     // First time. Get defaults from initial Framebuffer.
     do_luminance_correct_ = result->framebuffer()->luminance_correct();
   }
+  ApplyFrameCanvasDefaults(result);
+  created_frames_.push_back(result);
+  return result;
+}
 
-  result->framebuffer()->SetPWMBits(params_.pwm_bits);
-  result->framebuffer()->set_luminance_correct(do_luminance_correct_);
-  result->framebuffer()->SetBrightness(params_.brightness);
+void RGBMatrix::ApplyFrameCanvasDefaults(FrameCanvas *canvas) {
+  canvas->framebuffer()->SetPWMBits(params_.pwm_bits);
+  canvas->framebuffer()->set_luminance_correct(do_luminance_correct_);
+  // With pulse brightness, colors only get what the pulses can't do.
+  canvas->framebuffer()->SetBrightness(params_.pulse_brightness
+                                       ? pulse_color_brightness_
+                                       : params_.brightness);
+  canvas->framebuffer()->SetDither(params_.dither);
+}
 
-  created_frames_.push_back(result);
+FrameCanvas *RGBMatrix::AcquireFrameCanvas() {
+  if (canvas_pool_.empty())
+    return CreateFrameCanvas();
+  FrameCanvas *const result = canvas_pool_.back();
+  canvas_pool_.pop_back();
+  ApplyFrameCanvasDefaults(result);
   return result;
 }
 
+bool RGBMatrix::ReleaseFrameCanvas(FrameCanvas *canvas) {
+  if (canvas == NULL || canvas == active_) return false;
+  if (updater_ && updater_->IsInUse(canvas)) return false;
+  if (canvas_pool_.size() < canvas_pool_size_) {
+    canvas_pool_.push_back(canvas);
+    return true;
+  }
+  created_frames_.erase(std::remove(created_frames_.begin(),
+                                    created_frames_.end(), canvas),
+                        created_frames_.end());
+  delete canvas;
+  return true;
+}
+
+void RGBMatrix::SetFrameCanvasPoolSize(int size) {
+  canvas_pool_size_ = std::max(size, 0);
+  while (canvas_pool_.size() > canvas_pool_size_) {
+    FrameCanvas *const canvas = canvas_pool_.back();
+    canvas_pool_.pop_back();
+    created_frames_.erase(std::remove(created_frames_.begin(),
+                                      created_frames_.end(), canvas),
+                          created_frames_.end());
+    delete canvas;
+  }
+}
+
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned frame_fraction) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
@@ -387,6 +906,58 @@ FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
   return previous;
 }
 
+RgbFrameCanvas *RGBMatrix::CreateRgbFrameCanvas() {
+  if (row_converter_ == NULL) {
+    // One CPU is busy with refreshing, and the submitting thread does its
+    // share as well. Keep the workers off the CPU of the refresh thread if
+    // it could be tied to one (see StartRefresh()).
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const uint32_t all_cpus = cpus >= 32 ? 0xffffffff : (1u << cpus) - 1;
+    uint32_t worker_cpus = all_cpus & ~(1u << kRefreshCpu);
+    if (worker_cpus == all_cpus) worker_cpus = 0;  // Not tied; no affinity.
+    row_converter_ = new RowConverter(std::max(0L, cpus - 2), worker_cpus);
+  }
+  RgbFrameCanvas *result = new RgbFrameCanvas(CreateFrameCanvas(),
+                                              CreateFrameCanvas());
+  created_rgb_frames_.push_back(result);
+  return result;
+}
+
+void RGBMatrix::SubmitOnVSync(RgbFrameCanvas *canvas,
+                              unsigned framerate_fraction) {
+  const int index = canvas->next_frame_;
+  const uint8_t stale_bit = 1 << index;
+  std::vector<int> rows;
+  for (int y = 0; y < canvas->height_; ++y) {
+    if (canvas->stale_rows_[y] & stale_bit) {
+      rows.push_back(y);
+      canvas->stale_rows_[y] &= ~stale_bit;
+    }
+  }
+  FrameCanvas *const frame = canvas->frames_[index];
+  row_converter_->Convert(frame->framebuffer(), canvas->rgb_data(),
+                          canvas->width_, rows);
+  canvas->next_frame_ = 1 - index;
+  SwapOnVSync(frame, framerate_fraction);
+}
+
+FrameCanvas *RGBMatrix::CrossFade(FrameCanvas *from, FrameCanvas *to,
+                                  uint32_t duration_us) {
+  FrameCanvas *previous;
+  if (updater_ == NULL) {
+    previous = active_;
+  } else {
+    previous = updater_->CrossFade(from, to, duration_us);
+  }
+  active_ = to;
+  return previous;
+}
+
+void RGBMatrix::SetOverlay(FrameCanvas *overlay) {
+  if (overlay) overlay->framebuffer()->AllocateOverlayMask();
+  if (updater_) updater_->SetOverlay(overlay);
+}
+
 uint32_t RGBMatrix::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
@@ -405,22 +976,46 @@ uint8_t RGBMatrix::pwmbits() { return params_.pwm_bits; }
 void RGBMatrix::set_luminance_correct(bool on) {
   active_->framebuffer()->set_luminance_correct(on);
   do_luminance_correct_ = on;
+  ApplyPulseBrightness();
 }
 bool RGBMatrix::luminance_correct() const {
   return do_luminance_correct_;
 }
 
 void RGBMatrix::SetBrightness(uint8_t brightness) {
+  if (params_.pulse_brightness) {
+    params_.brightness = brightness;
+    ApplyPulseBrightness();
+    return;
+  }
   for (size_t i = 0; i < created_frames_.size(); ++i) {
     created_frames_[i]->framebuffer()->SetBrightness(brightness);
   }
   params_.brightness = brightness;
 }
 
+void RGBMatrix::ApplyPulseBrightness() {
+  if (!params_.pulse_brightness || io_ == NULL) return;
+  pulse_color_brightness_
+    = Framebuffer::SetPulseBrightness(params_.brightness,
+                                      do_luminance_correct_);
+  for (size_t i = 0; i < created_frames_.size(); ++i) {
+    created_frames_[i]->framebuffer()->SetBrightness(pulse_color_brightness_);
+  }
+}
+
 uint8_t RGBMatrix::brightness() {
   return params_.brightness;
 }
 
+void RGBMatrix::SetPaletteColor(uint8_t index,
+                                uint8_t red, uint8_t green, uint8_t blue,
+                                bool recolor) {
+  for (size_t i = 0; i < created_frames_.size(); ++i) {
+    created_frames_[i]->SetPaletteColor(index, red, green, blue, recolor);
+  }
+}
+
 // -- Implementation of RGBMatrix Canvas: delegation to ContentBuffer
 int RGBMatrix::width() const {
   return active_->width();
@@ -442,35 +1037,184 @@ void RGBMatrix::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   active_->Fill(red, green, blue);
 }
 
-bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
-  if (mapper == NULL) return true;
-  using internal::PixelDesignatorMap;
-  const int old_width = shared_pixel_mapper_->width();
-  const int old_height = shared_pixel_mapper_->height();
-  int new_width, new_height;
-  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
-    return false;
-  }
-  PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
-    new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
-  for (int y = 0; y < new_height; ++y) {
+void RGBMatrix::FillSpan(int x, int y, int length,
+                         uint8_t red, uint8_t green, uint8_t blue) {
+  active_->FillSpan(x, y, length, red, green, blue);
+}
+
+void RGBMatrix::PrepareColor(uint8_t red, uint8_t green, uint8_t blue,
+                             PreparedColor *color) {
+  active_->PrepareColor(red, green, blue, color);
+}
+
+void RGBMatrix::SetPixel(int x, int y, const PreparedColor &color) {
+  active_->SetPixel(x, y, color);
+}
+
+uint32_t RGBMatrix::color_settings() const {
+  return active_->color_settings();
+}
+
+void RGBMatrix::DrawBitmap(int x, int y, int width, int height,
+                           const uint64_t *rows,
+                           const PreparedColor &foreground,
+                           const PreparedColor *background) {
+  active_->DrawBitmap(x, y, width, height, rows, foreground, background);
+}
+
+void RGBMatrix::SetPixels(const Pixel *pixels, int count) {
+  active_->SetPixels(pixels, count);
+}
+
+void RGBMatrix::SetRow(int x, int y, int length, const uint8_t *rgb) {
+  active_->SetRow(x, y, length, rgb);
+}
+
+namespace {
+// Maps the rows [y_start, y_end) of the new map from the old map.
+void MapPixelRows(const PixelMapper *mapper,
+                  PixelDesignatorMap *old_map, PixelDesignatorMap *new_map,
+                  int y_start, int y_end) {
+  const int old_width = old_map->width();
+  const int old_height = old_map->height();
+  const int new_width = new_map->width();
+  for (int y = y_start; y < y_end; ++y) {
     for (int x = 0; x < new_width; ++x) {
       int orig_x = -1, orig_y = -1;
       mapper->MapVisibleToMatrix(old_width, old_height,
                                  x, y, &orig_x, &orig_y);
+      if (orig_x == -1 && orig_y == -1)
+        continue;  // Not connected.
       if (orig_x < 0 || orig_y < 0 ||
           orig_x >= old_width || orig_y >= old_height) {
         fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
                 "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
         continue;
       }
-      const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
-      *new_mapper->get(x, y) = *orig_designator;
+      *new_map->get(x, y) = *old_map->get(orig_x, orig_y);
+    }
+  }
+}
+
+class PixelMapperWorker : public Thread {
+public:
+  PixelMapperWorker(const PixelMapper *mapper,
+                    PixelDesignatorMap *old_map, PixelDesignatorMap *new_map,
+                    int y_start, int y_end)
+    : mapper_(mapper), old_map_(old_map), new_map_(new_map),
+      y_start_(y_start), y_end_(y_end) {}
+
+  virtual void Run() {
+    MapPixelRows(mapper_, old_map_, new_map_, y_start_, y_end_);
+  }
+
+private:
+  const PixelMapper *const mapper_;
+  PixelDesignatorMap *const old_map_;
+  PixelDesignatorMap *const new_map_;
+  const int y_start_;
+  const int y_end_;
+};
+
+// Create a new map with "mapper" applied to "old_map". Returns NULL if
+// the mapper can't be applied.
+PixelDesignatorMap *CreateMappedDesignatorMap(
+  PixelDesignatorMap *old_map, const PixelMapper *mapper) {
+  const int old_width = old_map->width();
+  const int old_height = old_map->height();
+  int new_width, new_height;
+  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
+    return NULL;
+  }
+  PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
+    new_width, new_height, old_map->GetFillColorBits());
+
+  // Small maps are done quickly; only spread large ones over all cores.
+  static const int kMinPixelsPerThread = 16384;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > new_width * new_height / kMinPixelsPerThread)
+    threads = new_width * new_height / kMinPixelsPerThread;
+  if (threads > new_height) threads = new_height;
+  if (threads <= 1) {
+    MapPixelRows(mapper, old_map, new_mapper, 0, new_height);
+  } else {
+    std::vector<PixelMapperWorker*> workers;
+    for (int i = 0; i < threads; ++i) {
+      PixelMapperWorker *worker
+        = new PixelMapperWorker(mapper, old_map, new_mapper,
+                                i * new_height / threads,
+                                (i + 1) * new_height / threads);
+      worker->Start();
+      workers.push_back(worker);
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+      delete workers[i];  // Waits for the thread to finish.
     }
   }
+  new_mapper->CompileRuns();
+  return new_mapper;
+}
+}  // anonymous namespace
+
+bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
+  if (mapper == NULL) return true;
+  if (!pixel_mappings_.empty()) {
+    fprintf(stderr, "ApplyPixelMapper(): not possible after "
+            "PrecomputePixelMapping()\n");
+    return false;
+  }
+  PixelDesignatorMap *new_mapper
+    = CreateMappedDesignatorMap(shared_pixel_mapper_, mapper);
+  if (new_mapper == NULL) return false;
   delete shared_pixel_mapper_;
   shared_pixel_mapper_ = new_mapper;
+  if (row_converter_) row_converter_->ResetRowGroups();
+  return true;
+}
+
+int RGBMatrix::PrecomputePixelMapping(const PixelMapper *mapper) {
+  if (pixel_mappings_.empty()) {
+    pixel_mappings_.push_back(shared_pixel_mapper_);  // id 0: initial.
+  }
+  if (mapper == NULL) return 0;
+  PixelDesignatorMap *new_mapper
+    = CreateMappedDesignatorMap(pixel_mappings_[0], mapper);
+  if (new_mapper == NULL) return -1;
+  pixel_mappings_.push_back(new_mapper);
+  return pixel_mappings_.size() - 1;
+}
+
+bool RGBMatrix::SwitchPixelMapping(int id) {
+  if (id < 0 || id >= (int)pixel_mappings_.size()) return false;
+  PixelDesignatorMap *const new_mapper = pixel_mappings_[id];
+  if (new_mapper == shared_pixel_mapper_) return true;
+
+  // Prepare re-arranged content for all frames, then swap it in at VSync so
+  // that the currently displayed frame is not modified while shown.
+  std::vector<Framebuffer*> frames;
+  std::vector<plane_bits_t*> buffers;
+  for (size_t i = 0; i < created_frames_.size(); ++i) {
+    Framebuffer *const frame = created_frames_[i]->framebuffer();
+    frames.push_back(frame);
+    buffers.push_back(frame->CreateRemappedBuffer(*shared_pixel_mapper_,
+                                                  *new_mapper));
+  }
+  if (updater_) {
+    updater_->ReplaceBuffersOnVSync(frames, &buffers,
+                                    &shared_pixel_mapper_, new_mapper);
+  } else {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      buffers[i] = frames[i]->ReplaceBitplaneBuffer(buffers[i]);
+    }
+    shared_pixel_mapper_ = new_mapper;
+  }
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    frames[i]->FreeBitplaneBuffer(buffers[i]);
+  }
+  for (size_t i = 0; i < created_rgb_frames_.size(); ++i) {
+    created_rgb_frames_[i]->Resize();
+  }
+  if (row_converter_) row_converter_->ResetRowGroups();
   return true;
 }
 
@@ -515,6 +1259,11 @@ void RGBMatrix::ApplyStaticTransformerDeprecated(
   const CanvasTransformer &transformer) {
   using internal::PixelDesignatorMap;
   assert(shared_pixel_mapper_);  // Not initialized yet ?
+  if (!pixel_mappings_.empty()) {
+    fprintf(stderr, "ApplyStaticTransformer(): not possible after "
+            "PrecomputePixelMapping()\n");
+    return;
+  }
   PixelMapExtractionCanvas extractor_canvas(shared_pixel_mapper_);
 
   // These transformers traditionally only a non-const Transform()
@@ -544,8 +1293,10 @@ void RGBMatrix::ApplyStaticTransformerDeprecated(
       mapped_canvas->SetPixel(x, y, 0, 0, 0); // force copy of designator.
     }
   }
+  new_mapper->CompileRuns();
   delete shared_pixel_mapper_;
   shared_pixel_mapper_ = new_mapper;
+  if (row_converter_) row_converter_->ResetRowGroups();
 }
 #endif  // REMOVE_DEPRECATED_TRANSFORMERS
 
@@ -561,8 +1312,66 @@ void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
 }
+void FrameCanvas::FillSpan(int x, int y, int length,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->FillSpan(x, y, length, red, green, blue);
+}
+void FrameCanvas::PrepareColor(uint8_t red, uint8_t green, uint8_t blue,
+                               PreparedColor *color) {
+  internal::PlaneColor planes;
+  frame_->PrepareColor(red, green, blue, &planes);
+  color->red = red;
+  color->green = green;
+  color->blue = blue;
+  color->color_settings = frame_->color_settings();
+  memcpy(color->planes, planes.plane, sizeof(color->planes));
+}
+void FrameCanvas::SetPixel(int x, int y, const PreparedColor &color) {
+  if (color.color_settings != frame_->color_settings()) {
+    frame_->SetPixel(x, y, color.red, color.green, color.blue);
+    return;
+  }
+  internal::PlaneColor planes;
+  memcpy(planes.plane, color.planes, sizeof(planes.plane));
+  frame_->SetPixel(x, y, planes);
+}
+uint32_t FrameCanvas::color_settings() const {
+  return frame_->color_settings();
+}
+// Planes of "color" for "frame"; converted again if prepared for different
+// settings.
+static void ToPlaneColor(Framebuffer *frame, const PreparedColor &color,
+                         internal::PlaneColor *planes) {
+  if (color.color_settings != frame->color_settings()) {
+    frame->PrepareColor(color.red, color.green, color.blue, planes);
+  } else {
+    memcpy(planes->plane, color.planes, sizeof(planes->plane));
+  }
+}
+void FrameCanvas::DrawBitmap(int x, int y, int width, int height,
+                             const uint64_t *rows,
+                             const PreparedColor &foreground,
+                             const PreparedColor *background) {
+  internal::PlaneColor fg_planes, bg_planes;
+  ToPlaneColor(frame_, foreground, &fg_planes);
+  if (background) ToPlaneColor(frame_, *background, &bg_planes);
+  frame_->DrawBitmap(x, y, width, height, rows, fg_planes,
+                     background ? &bg_planes : NULL);
+}
+void FrameCanvas::SetPixels(const Pixel *pixels, int count) {
+  for (const Pixel *const end = pixels + count; pixels < end; ++pixels) {
+    frame_->SetPixel(pixels->x, pixels->y,
+                     pixels->red, pixels->green, pixels->blue);
+  }
+}
+void FrameCanvas::SetRow(int x, int y, int length, const uint8_t *rgb) {
+  frame_->SetRow(x, y, length, rgb);
+}
 bool FrameCanvas::SetPWMBits(uint8_t value) { return frame_->SetPWMBits(value); }
 uint8_t FrameCanvas::pwmbits() { return frame_->pwmbits(); }
+bool FrameCanvas::SetRowPWMBits(int y, int height, uint8_t value) {
+  return frame_->SetRowPWMBits(y, height, value);
+}
 
 // Map brightness of output linearly to input with CIE1931 profile.
 void FrameCanvas::set_luminance_correct(bool on) { frame_->set_luminance_correct(on); }
@@ -571,6 +1380,20 @@ bool FrameCanvas::luminance_correct() const { return frame_->luminance_correct()
 void FrameCanvas::SetBrightness(uint8_t brightness) { frame_->SetBrightness(brightness); }
 uint8_t FrameCanvas::brightness() { return frame_->brightness(); }
 
+void FrameCanvas::SetOverlayMask(int x, int y, int width, int height,
+                                 bool visible) {
+  frame_->SetOverlayMask(x, y, width, height, visible);
+}
+void FrameCanvas::SetOverlayMaskFromContent() {
+  frame_->SetOverlayMaskFromContent();
+}
+
+bool FrameCanvas::SetDither(int mode) { return frame_->SetDither(mode); }
+int FrameCanvas::dither() const { return frame_->dither(); }
+void FrameCanvas::SetDitherPhase(unsigned phase) {
+  frame_->SetDitherPhase(phase);
+}
+
 void FrameCanvas::Serialize(const char **data, size_t *len) const {
   frame_->Serialize(data, len);
 }
@@ -580,4 +1403,109 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+void FrameCanvas::CopyRegion(int x, int y, int width, int height,
+                             int dst_x, int dst_y) {
+  frame_->CopyRegion(x, y, width, height, dst_x, dst_y);
+}
+void FrameCanvas::ScrollRegion(int x, int y, int width, int height,
+                               int dx, int dy,
+                               uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->ScrollRegion(x, y, width, height, dx, dy, red, green, blue);
+}
+void FrameCanvas::Scroll(int dx, int dy,
+                         uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->ScrollRegion(0, 0, width(), height(), dx, dy, red, green, blue);
+}
+void FrameCanvas::SetPaletteColor(uint8_t index,
+                                  uint8_t red, uint8_t green, uint8_t blue,
+                                  bool recolor) {
+  frame_->SetPaletteColor(index, red, green, blue, recolor);
+}
+void FrameCanvas::SetIndexedRow(int x, int y, int length,
+                                const uint8_t *indices) {
+  frame_->SetIndexedRow(x, y, length, indices);
+}
+bool FrameCanvas::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) {
+  return frame_->GetPixel(x, y, red, green, blue);
+}
+void FrameCanvas::GetImage(int x, int y, int width, int height, uint8_t *rgb) {
+  frame_->GetImage(x, y, width, height, rgb);
+}
+bool FrameCanvas::GetPixelLevels(int x, int y, uint16_t *red,
+                                 uint16_t *green, uint16_t *blue) const {
+  return frame_->GetPixelLevels(x, y, red, green, blue);
+}
+
+// RgbFrameCanvas. Changed rows are stale in both FrameCanvases.
+static const uint8_t kRowStaleInBoth = 0x3;
+
+RgbFrameCanvas::RgbFrameCanvas(FrameCanvas *first, FrameCanvas *second)
+  : width_(first->width()), height_(first->height()),
+    rgb_(3 * width_ * height_, 0), next_frame_(0), stale_rows_(height_, 0) {
+  // Both start out black, just like the RGB content.
+  frames_[0] = first;
+  frames_[1] = second;
+}
+void RgbFrameCanvas::Resize() {
+  const int width = frames_[0]->width();
+  const int height = frames_[0]->height();
+  if (width != width_ || height != height_) {
+    std::vector<uint8_t> rgb(3 * width * height, 0);
+    const int copy_width = std::min(width, width_);
+    for (int y = 0; y < std::min(height, height_); ++y) {
+      memcpy(&rgb[3 * y * width], &rgb_[3 * y * width_], 3 * copy_width);
+    }
+    rgb_.swap(rgb);
+    width_ = width;
+    height_ = height;
+  }
+  stale_rows_.assign(height_, kRowStaleInBoth);
+}
+void RgbFrameCanvas::MarkRowsChanged(int y, int height) {
+  const int end_y = std::min(y + height, height_);
+  for (y = std::max(y, 0); y < end_y; ++y) stale_rows_[y] = kRowStaleInBoth;
+}
+void RgbFrameCanvas::SetPixel(int x, int y,
+                              uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+  uint8_t *pixel = &rgb_[3 * (y * width_ + x)];
+  pixel[0] = red;
+  pixel[1] = green;
+  pixel[2] = blue;
+  stale_rows_[y] = kRowStaleInBoth;
+}
+void RgbFrameCanvas::Clear() {
+  std::fill(rgb_.begin(), rgb_.end(), 0);
+  std::fill(stale_rows_.begin(), stale_rows_.end(), kRowStaleInBoth);
+}
+void RgbFrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  for (int y = 0; y < height_; ++y) FillSpan(0, y, width_, red, green, blue);
+}
+void RgbFrameCanvas::FillSpan(int x, int y, int length,
+                              uint8_t red, uint8_t green, uint8_t blue) {
+  if (y < 0 || y >= height_) return;
+  const int end_x = std::min(x + length, width_);
+  x = std::max(x, 0);
+  if (x >= end_x) return;
+  uint8_t *pixel = &rgb_[3 * (y * width_ + x)];
+  for (/**/; x < end_x; ++x, pixel += 3) {
+    pixel[0] = red;
+    pixel[1] = green;
+    pixel[2] = blue;
+  }
+  stale_rows_[y] = kRowStaleInBoth;
+}
+void RgbFrameCanvas::SetRow(int x, int y, int length, const uint8_t *rgb) {
+  if (y < 0 || y >= height_) return;
+  if (x < 0) {
+    length += x;
+    rgb -= 3 * x;
+    x = 0;
+  }
+  length = std::min(length, width_ - x);
+  if (length <= 0) return;
+  memcpy(&rgb_[3 * (y * width_ + x)], rgb, 3 * length);
+  stale_rows_[y] = kRowStaleInBoth;
+}
 }  // end namespace rgb_matrix
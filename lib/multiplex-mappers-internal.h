@@ -13,6 +13,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
+#include <string>
 #include <vector>
 
 #include "pixel-mapper.h"
@@ -34,5 +35,17 @@ public:
 typedef std::vector<const MultiplexMapper*> MuxMapperList;
 const MuxMapperList &GetRegisteredMultiplexMappers();
 
+// Find a multiplex mapper by its name (case insensitive) or create one
+// from a description "<stretch-factor>,<x-expression>,<y-expression>".
+// The expressions compute the matrix position of a pixel at x, y within a
+// panel of size w, h. They may use integer numbers, + - * / %,
+// comparisons, && || !, the ?: operator and parentheses. E.g. the "Stripe"
+// multiplexing is
+//   2,(y%(h/2) < h/4) ? x+w : x,(y/(h/2))*(h/4) + y%(h/4)
+// Returns NULL and appends a message to "err" if not found or the
+// description can't be parsed. Ownership is not transferred.
+const MultiplexMapper *FindMultiplexMapper(const char *name_or_spec,
+                                           std::string *err);
+
 }  // namespace internal
 }  // namespace rgb_matrix
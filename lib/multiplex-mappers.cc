@@ -15,6 +15,13 @@
 
 #include "multiplex-mappers-internal.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
 namespace rgb_matrix {
 namespace internal {
 // A Pixel Mapper maps physical pixels locations to the internal logical
@@ -29,12 +36,36 @@ public:
   // So technically, we're stateful, but let's pretend we're not changing
   // state. In the context this is used, it is never accessed in multiple
   // threads.
+  // Since all panels are the same, we compute the mapping of one panel
+  // here once, so MapVisibleToMatrix() is a simple lookup.
   virtual void EditColsRows(int *cols, int *rows) const {
     panel_rows_ = *rows;
     panel_cols_ = *cols;
 
     *rows /= panel_stretch_factor_;
     *cols *= panel_stretch_factor_;
+
+    const int matrix_cols = *cols;
+    const int matrix_rows = *rows;
+    panel_map_.resize(panel_cols_ * panel_rows_);
+    int errors = 0;
+    for (int y = 0; y < panel_rows_; ++y) {
+      for (int x = 0; x < panel_cols_; ++x) {
+        int new_x = -1, new_y = -1;
+        MapSinglePanel(x, y, &new_x, &new_y);
+        if (new_x < 0 || new_x >= matrix_cols ||
+            new_y < 0 || new_y >= matrix_rows) {
+          if (errors++ == 0 && (new_x != -1 || new_y != -1)) {
+            fprintf(stderr, "%s: panel pixel (%d, %d) -> (%d, %d) outside "
+                    "of %dx%d.\n", GetName(), x, y, new_x, new_y,
+                    matrix_cols, matrix_rows);
+          }
+          new_x = new_y = -1;  // Not connected.
+        }
+        panel_map_[y * panel_cols_ + x].x = new_x;
+        panel_map_[y * panel_cols_ + x].y = new_y;
+      }
+    }
   }
 
   virtual bool GetSizeMapping(int matrix_width, int matrix_height,
@@ -57,10 +88,13 @@ public:
     const int within_panel_x = visible_x % panel_cols_;
     const int within_panel_y = visible_y % panel_rows_;
 
-    int new_x, new_y;
-    MapSinglePanel(within_panel_x, within_panel_y, &new_x, &new_y);
-    *matrix_x = chained_panel  * panel_stretch_factor_*panel_cols_ + new_x;
-    *matrix_y = parallel_panel * panel_rows_/panel_stretch_factor_ + new_y;
+    const PanelPixel &p = panel_map_[within_panel_y*panel_cols_ + within_panel_x];
+    if (p.x < 0) {
+      *matrix_x = *matrix_y = -1;
+      return;
+    }
+    *matrix_x = chained_panel  * panel_stretch_factor_*panel_cols_ + p.x;
+    *matrix_y = parallel_panel * panel_rows_/panel_stretch_factor_ + p.y;
   }
 
   // Map the coordinates for a single panel. This is to be overridden in
@@ -73,6 +107,10 @@ protected:
 
   mutable int panel_cols_;
   mutable int panel_rows_;
+
+private:
+  struct PanelPixel { int x, y; };
+  mutable std::vector<PanelPixel> panel_map_;  // Precomputed MapSinglePanel()
 };
 
 
@@ -86,6 +124,9 @@ protected:
  * Don't forget to register the new multiplexer sin CreateMultiplexMapperList()
  * below. After that, the new mapper is available in the --led-multiplexing
  * option.
+ *
+ * Simple multiplexings can also be given as description on the command line
+ * without writing code, see FindMultiplexMapper().
  */
 class StripeMultiplexMapper : public MultiplexMapperBase {
 public:
@@ -254,6 +295,214 @@ public:
   }
 };
 
+/*
+ * Multiplexing described by a stretch factor and two expressions for the
+ * x and y position on the matrix; see FindMultiplexMapper().
+ */
+class MuxExpression {
+public:
+  MuxExpression() : root_(-1) {}
+
+  // Parse expression, up to the first ',' or end of string. Returns the
+  // position after the expression or NULL on error.
+  const char *Parse(const char *expr, std::string *err) {
+    nodes_.clear();
+    pos_ = expr;
+    error_ = NULL;
+    root_ = ParseConditional();
+    SkipSpace();
+    if (!error_ && *pos_ != ',' && *pos_ != '\0')
+      error_ = "unexpected character";
+    if (error_) {
+      char buffer[256];
+      snprintf(buffer, sizeof(buffer),
+               "Multiplexing expression: %s at '%s'\n", error_, pos_);
+      err->append(buffer);
+      return NULL;
+    }
+    return pos_;
+  }
+
+  int Eval(int x, int y, int w, int h) const {
+    return Eval(root_, x, y, w, h);
+  }
+
+private:
+  // Operators are identified by a character. 'n' is a numeric constant, 'x',
+  // 'y', 'w', 'h' the variables and the others mostly their C-equivalent; for
+  // two-character operators the first one ('&', '|', '=') or the upper-case
+  // version ('L' <=, 'G' >=, 'N' !=). Unary minus is 'u'.
+  struct Node {
+    char op;
+    int value;
+    int a, b, c;  // Operands: index into nodes_.
+  };
+
+  int Add(char op, int a, int b = -1, int c = -1, int value = 0) {
+    Node n = { op, value, a, b, c };
+    nodes_.push_back(n);
+    return nodes_.size() - 1;
+  }
+
+  void SkipSpace() { while (isspace(*pos_)) ++pos_; }
+
+  // Consume "token" if it is next in the input.
+  bool Accept(const char *token) {
+    SkipSpace();
+    const size_t len = strlen(token);
+    if (strncmp(pos_, token, len) != 0) return false;
+    // Don't confuse '<' with '<=' etc.
+    if (len == 1 && (token[0] == '<' || token[0] == '>' || token[0] == '!')
+        && pos_[1] == '=')
+      return false;
+    pos_ += len;
+    return true;
+  }
+
+  int ParseConditional() {
+    const int condition = ParseBinary(0);
+    if (!Accept("?")) return condition;
+    const int if_true = ParseConditional();
+    if (!Accept(":")) {
+      if (!error_) error_ = "expected ':'";
+      return -1;
+    }
+    return Add('?', condition, if_true, ParseConditional());
+  }
+
+  // Binary operators by increasing precedence.
+  int ParseBinary(int level) {
+    static const char *const kOperators[][5] = {
+      { "||", NULL },
+      { "&&", NULL },
+      { "==", "!=", NULL },
+      { "<=", ">=", "<", ">", NULL },
+      { "+", "-", NULL },
+      { "*", "/", "%", NULL },
+    };
+    static const char kOpCode[][5] = {
+      { '|' }, { '&' }, { '=', 'N' }, { 'L', 'G', '<', '>' },
+      { '+', '-' }, { '*', '/', '%' },
+    };
+    static const int kLevels = sizeof(kOpCode) / sizeof(kOpCode[0]);
+    if (level == kLevels) return ParseUnary();
+    int left = ParseBinary(level + 1);
+    for (;;) {
+      int op = 0;
+      while (kOperators[level][op] && !Accept(kOperators[level][op]))
+        ++op;
+      if (kOperators[level][op] == NULL) return left;
+      left = Add(kOpCode[level][op], left, ParseBinary(level + 1));
+    }
+  }
+
+  int ParseUnary() {
+    if (Accept("-")) return Add('u', ParseUnary());
+    if (Accept("!")) return Add('!', ParseUnary());
+    if (Accept("(")) {
+      const int result = ParseConditional();
+      if (!Accept(")") && !error_) error_ = "expected ')'";
+      return result;
+    }
+    SkipSpace();
+    if (isdigit(*pos_)) {
+      char *end;
+      const int value = strtol(pos_, &end, 10);
+      pos_ = end;
+      return Add('n', -1, -1, -1, value);
+    }
+    const char var = tolower(*pos_);
+    if ((var == 'x' || var == 'y' || var == 'w' || var == 'h')
+        && !isalnum(pos_[1])) {
+      ++pos_;
+      return Add(var, -1);
+    }
+    if (!error_) error_ = "expected number, variable x, y, w, h or '('";
+    return -1;
+  }
+
+  int Eval(int i, int x, int y, int w, int h) const {
+    const Node &n = nodes_[i];
+    int a = 0, b = 0;
+    switch (n.op) {
+    case 'n': return n.value;
+    case 'x': return x;
+    case 'y': return y;
+    case 'w': return w;
+    case 'h': return h;
+    case '?': return Eval(n.a, x, y, w, h)
+        ? Eval(n.b, x, y, w, h) : Eval(n.c, x, y, w, h);
+    case '&': return Eval(n.a, x, y, w, h) && Eval(n.b, x, y, w, h);
+    case '|': return Eval(n.a, x, y, w, h) || Eval(n.b, x, y, w, h);
+    }
+    a = Eval(n.a, x, y, w, h);
+    if (n.b >= 0) b = Eval(n.b, x, y, w, h);
+    switch (n.op) {
+    case 'u': return -a;
+    case '!': return !a;
+    case '+': return a + b;
+    case '-': return a - b;
+    case '*': return a * b;
+    case '/': return b ? a / b : -1;
+    case '%': return b ? a % b : -1;
+    case '<': return a < b;
+    case '>': return a > b;
+    case 'L': return a <= b;
+    case 'G': return a >= b;
+    case '=': return a == b;
+    case 'N': return a != b;
+    }
+    return -1;
+  }
+
+  std::vector<Node> nodes_;
+  int root_;
+  const char *pos_;     // Parse position.
+  const char *error_;   // Parse error.
+};
+
+class ExpressionMultiplexMapper : public MultiplexMapperBase {
+public:
+  // Create from description. Returns NULL if there was a problem.
+  static ExpressionMultiplexMapper *Create(const char *spec, std::string *err) {
+    char *end;
+    const int stretch = strtol(spec, &end, 10);
+    if (end == spec || *end != ',' || stretch < 1) {
+      err->append("Multiplexing description needs to start with "
+                  "stretch-factor, e.g. '2,'\n");
+      return NULL;
+    }
+    ExpressionMultiplexMapper *result = new ExpressionMultiplexMapper(stretch);
+    const char *pos = result->x_.Parse(end + 1, err);
+    if (pos && *pos != ',') {
+      err->append("Multiplexing description needs expressions for x and y\n");
+      pos = NULL;
+    }
+    if (pos) pos = result->y_.Parse(pos + 1, err);
+    if (pos && *pos != '\0') {
+      err->append("Multiplexing description: more than x and y expression\n");
+      pos = NULL;
+    }
+    if (!pos) {
+      delete result;
+      return NULL;
+    }
+    return result;
+  }
+
+  void MapSinglePanel(int x, int y, int *matrix_x, int *matrix_y) const {
+    *matrix_x = x_.Eval(x, y, panel_cols_, panel_rows_);
+    *matrix_y = y_.Eval(x, y, panel_cols_, panel_rows_);
+  }
+
+private:
+  explicit ExpressionMultiplexMapper(int stretch)
+    : MultiplexMapperBase("Expression", stretch) {}
+
+  MuxExpression x_;
+  MuxExpression y_;
+};
+
 /*
  * Here is where the registration happens.
  * If you add an instance of the mapper here, it will automatically be
@@ -280,5 +529,29 @@ const MuxMapperList &GetRegisteredMultiplexMappers() {
   static const MuxMapperList *all_mappers = CreateMultiplexMapperList();
   return *all_mappers;
 }
+const MultiplexMapper *FindMultiplexMapper(const char *name_or_spec,
+                                           std::string *err) {
+  const MuxMapperList &registered = GetRegisteredMultiplexMappers();
+  for (size_t i = 0; i < registered.size(); ++i) {
+    if (strcasecmp(registered[i]->GetName(), name_or_spec) == 0)
+      return registered[i];
+  }
+  if (!isdigit(*name_or_spec)) {
+    err->append("No multiplexing named '").append(name_or_spec).append("'\n");
+    return NULL;
+  }
+
+  // Keep the ones we have seen already, so that we don't create a new one
+  // each time.
+  typedef std::map<std::string, const MultiplexMapper*> SpecMap;
+  static SpecMap *from_spec = new SpecMap();
+  SpecMap::const_iterator found = from_spec->find(name_or_spec);
+  if (found != from_spec->end())
+    return found->second;
+  const MultiplexMapper *result
+    = ExpressionMultiplexMapper::Create(name_or_spec, err);
+  if (result) (*from_spec)[name_or_spec] = result;
+  return result;
+}
 }  // namespace internal
 }  // namespace rgb_matrix
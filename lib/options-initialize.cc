@@ -23,8 +23,10 @@
 #include <grp.h>
 #include <pwd.h>
 
+#include <algorithm>
 #include <vector>
 
+#include "hardware-mapping.h"
 #include "multiplex-mappers-internal.h"
 
 namespace rgb_matrix {
@@ -136,6 +138,8 @@ static bool FlagInit(int &argc, char **&argv,
   unused_options.push_back(*it++);  // Not interested in program name
 
   bool bool_scratch;
+  const char *wall = NULL;
+  bool chain_or_parallel_given = false;  // Conflicts with wall.
   int err = 0;
   bool posix_end_option_seen = false;  // end of options '--'
   for (/**/; it < end; ++it) {
@@ -153,16 +157,37 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeStringFlag("panel-type", it, end,
                             &mopts->panel_type, &err))
         continue;
+      if (ConsumeStringFlag("pixel-mapping-cache", it, end,
+                            &mopts->pixel_mapping_cache, &err))
+        continue;
+      if (ConsumeStringFlag("wall", it, end, &wall, &err))
+        continue;
       if (ConsumeIntFlag("rows", it, end, &mopts->rows, &err))
         continue;
       if (ConsumeIntFlag("cols", it, end, &mopts->cols, &err))
         continue;
-      if (ConsumeIntFlag("chain", it, end, &mopts->chain_length, &err))
+      if (ConsumeIntFlag("chain", it, end, &mopts->chain_length, &err)) {
+        chain_or_parallel_given = true;
         continue;
-      if (ConsumeIntFlag("parallel", it, end, &mopts->parallel, &err))
+      }
+      if (ConsumeIntFlag("parallel", it, end, &mopts->parallel, &err)) {
+        chain_or_parallel_given = true;
         continue;
-      if (ConsumeIntFlag("multiplexing", it, end, &mopts->multiplexing, &err))
+      }
+      const char *multiplexing = NULL;
+      if (ConsumeStringFlag("multiplexing", it, end, &multiplexing, &err)) {
+        // Either the number of a registered multiplexer or name/description.
+        char *end_value = NULL;
+        const int value = multiplexing ? strtol(multiplexing, &end_value, 10)
+          : 0;
+        if (multiplexing && *multiplexing && *end_value == '\0') {
+          mopts->multiplexing = value;
+          mopts->multiplexing_name = NULL;
+        } else {
+          mopts->multiplexing_name = multiplexing;
+        }
         continue;
+      }
       if (ConsumeIntFlag("brightness", it, end, &mopts->brightness, &err))
         continue;
       if (ConsumeIntFlag("scan-mode", it, end, &mopts->scan_mode, &err))
@@ -175,6 +200,11 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeIntFlag("pwm-dither-bits", it, end,
                          &mopts->pwm_dither_bits, &err))
         continue;
+      if (ConsumeIntFlag("dither", it, end, &mopts->dither, &err))
+        continue;
+      if (ConsumeIntFlag("idle-refresh-hz", it, end,
+                         &mopts->idle_refresh_hz, &err))
+        continue;
       if (ConsumeIntFlag("row-addr-type", it, end,
                          &mopts->row_address_type, &err))
         continue;
@@ -182,6 +212,12 @@ static bool FlagInit(int &argc, char **&argv,
         continue;
       if (ConsumeBoolFlag("inverse", it, &mopts->inverse_colors))
         continue;
+      if (ConsumeBoolFlag("pulse-brightness", it, &mopts->pulse_brightness))
+        continue;
+      if (ConsumeBoolFlag("low-power-idle", it, &mopts->low_power_idle))
+        continue;
+      if (ConsumeBoolFlag("huge-pages", it, &mopts->huge_pages))
+        continue;
       // We don't have a swap_green_blue option anymore, but we simulate the
       // flag for a while.
       bool swap_green_blue;
@@ -232,6 +268,26 @@ static bool FlagInit(int &argc, char **&argv,
     return false;
   }
 
+  if (wall != NULL) {
+    // Needs to be done last, as it depends on hardware mapping and pixel
+    // mappers that might come later in the flags.
+    int panels_x, panels_y;
+    std::string wall_err;
+    if (chain_or_parallel_given) {
+      fprintf(stderr, "--led-wall determines chain and parallel; "
+              "don't combine it with --led-chain or --led-parallel.\n");
+      return false;
+    }
+    if (sscanf(wall, "%dx%d", &panels_x, &panels_y) != 2) {
+      fprintf(stderr, "--led-wall: expected <panels-x>x<panels-y>\n");
+      return false;
+    }
+    if (!BalanceChainsForWall(panels_x, panels_y, mopts, &wall_err)) {
+      fprintf(stderr, "%s", wall_err.c_str());
+      return false;
+    }
+  }
+
   if (remove_consumed_options) {
     // Success. Re-arrange flags to only include the ones not consumed.
     argc = (int) unused_options.size();
@@ -381,6 +437,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "\t--led-parallel=<parallel> : Parallel chains. range=1..3 "
           "(Default: %d).\n"
           "\t--led-multiplexing=<0..%d> : Mux type: 0=direct; %s (Default: 0)\n"
+          "\t                            Or the name, or a description "
+          "\"<stretch>,<x-expr>,<y-expr>\"\n"
           "\t--led-pixel-mapper        : Semicolon-separated list of pixel-mappers to arrange pixels.\n"
           "\t                            Optional params after a colon e.g. \"U-mapper;Rotate:90\"\n"
           "\t                            Available: %s. Default: \"\"\n"
@@ -395,12 +453,33 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           ": Switch if your matrix has inverse colors %s.\n"
           "\t--led-rgb-sequence        : Switch if your matrix has led colors "
           "swapped (Default: \"RGB\")\n"
+          "\t--led-%spulse-brightness  : %sim with the output enable pulses, "
+          "keeps color depth.\n"
           "\t--led-pwm-lsb-nanoseconds : PWM Nanoseconds for LSB "
           "(Default: %d)\n"
           "\t--led-pwm-dither-bits=<0..2> : Time dithering of lower bits "
           "(Default: 0)\n"
+          "\t--led-dither=<0..2>       : Spatial dithering with less than 11 "
+          "pwm bits;\n"
+          "\t                            0 = off; 1 = ordered; 2 = blue noise "
+          "(Default: %d).\n"
+          "\t--led-%slow-power-idle    : %stop refresh while the frame is "
+          "black; no performance governor.\n"
+          "\t--led-idle-refresh-hz=<Hz> : Refresh rate for frames that didn't "
+          "change for a second;\n"
+          "\t                            0 = full speed (Default: %d).\n"
+          "\t--led-%shuge-pages        : %sllocate FrameCanvases in huge "
+          "pages.\n"
           "\t--led-%shardware-pulse   : %sse hardware pin-pulse generation.\n"
-          "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A'\n",
+          "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A'\n"
+          "\t--led-wall=<W>x<H>        : Size of the wall in panels. Sets "
+          "chain, parallel and\n"
+          "\t                            the Balanced pixel mapper for "
+          "the fastest refresh.\n"
+          "\t                            Can't be combined with --led-chain "
+          "or --led-parallel.\n"
+          "\t--led-pixel-mapping-cache=<dir> : Directory to cache the "
+          "computed pixel mapping in (Default: none).\n",
           d.hardware_mapping,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
@@ -408,7 +487,11 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           d.pwm_bits, d.brightness, d.scan_mode,
           d.show_refresh_rate ? "no-" : "", d.show_refresh_rate ? "Don't s" : "S",
           d.inverse_colors ? "no-" : "",    d.inverse_colors ? "off" : "on",
-          d.pwm_lsb_nanoseconds,
+          d.pulse_brightness ? "no-" : "",  d.pulse_brightness ? "Don't d" : "D",
+          d.pwm_lsb_nanoseconds, d.dither,
+          d.low_power_idle ? "no-" : "",    d.low_power_idle ? "Don't s" : "S",
+          d.idle_refresh_hz,
+          d.huge_pages ? "no-" : "",        d.huge_pages ? "Don't a" : "A",
           !d.disable_hardware_pulsing ? "no-" : "",
           !d.disable_hardware_pulsing ? "Don't u" : "U");
 
@@ -431,6 +514,57 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
   }
 }
 
+bool BalanceChainsForWall(int panels_x, int panels_y,
+                          RGBMatrix::Options *options, std::string *err) {
+  if (panels_x < 1 || panels_y < 1) {
+    err->append("Wall needs to be at least one panel.\n");
+    return false;
+  }
+  const char *named_hardware = options->hardware_mapping;
+  if (named_hardware == NULL || *named_hardware == '\0')
+    named_hardware = "regular";
+  const struct HardwareMapping *mapping = NULL;
+  for (const HardwareMapping *it = matrix_hardware_mappings; it->name; ++it) {
+    if (strcasecmp(it->name, named_hardware) == 0) {
+      mapping = it;
+      break;
+    }
+  }
+  if (mapping == NULL) {
+    err->append("Unknown hardware mapping '").append(named_hardware)
+      .append("'\n");
+    return false;
+  }
+  int max_parallel = mapping->max_parallel_chains;
+  if (max_parallel == 0) {  // Not determined yet; count the connectors.
+    const struct HardwareMapping &h = *mapping;
+    max_parallel = ((h.p0_r1 | h.p0_g1 | h.p0_b1) != 0)
+      + ((h.p1_r1 | h.p1_g1 | h.p1_b1) != 0)
+      + ((h.p2_r1 | h.p2_g1 | h.p2_b1) != 0);
+  }
+
+  // The longest chain determines the refresh rate. Spread the panels
+  // evenly; then use only as many chains as needed for that length.
+  const int panels = panels_x * panels_y;
+  int parallel = std::min(max_parallel, panels);
+  const int chain = (panels + parallel - 1) / parallel;
+  parallel = (panels + chain - 1) / chain;
+  options->chain_length = chain;
+  options->parallel = parallel;
+
+  char balanced_config[64];
+  snprintf(balanced_config, sizeof(balanced_config), "Balanced:%dx%d",
+           panels_x, panels_y);
+  std::string config = balanced_config;
+  if (options->pixel_mapper_config && *options->pixel_mapper_config) {
+    config.append(";").append(options->pixel_mapper_config);
+  }
+  // Owned by the caller from now on, like the strings set by
+  // ParseOptionsFromFlags(); see the BalanceChainsForWall() documentation.
+  options->pixel_mapper_config = strdup(config.c_str());
+  return true;
+}
+
 bool RGBMatrix::Options::Validate(std::string *err_in) const {
   std::string scratch;
   std::string *err = err_in ? err_in : &scratch;
@@ -460,6 +594,15 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
+  if (multiplexing_name && *multiplexing_name) {
+    if (internal::FindMultiplexMapper(multiplexing_name, err) == NULL) {
+      err->append("Multiplexing can be one of ")
+        .append(CreateAvailableMultiplexString(muxers))
+        .append(" or a description <stretch>,<x-expr>,<y-expr>\n");
+      success = false;
+    }
+  }
+
   if (row_address_type < 0 || row_address_type > 3) {
     err->append("Row address type values can be 0 (default), 1 (AB addressing), 2 (direct row select), 3 ABC address.\n");
     success = false;
@@ -495,6 +638,16 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
+  if (dither < 0 || dither > 2) {
+    err->append("Invalid dither mode (0..2 allowed).\n");
+    success = false;
+  }
+
+  if (idle_refresh_hz < 0 || idle_refresh_hz > 10000) {
+    err->append("Invalid range of idle-refresh-hz (0..10000 allowed).\n");
+    success = false;
+  }
+
   if (led_rgb_sequence == NULL || strlen(led_rgb_sequence) != 3) {
     err->append("led-sequence needs to be three characters long.\n");
     success = false;
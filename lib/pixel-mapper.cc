@@ -16,11 +16,18 @@
 #include "pixel-mapper.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <map>
+#include <string>
+#include <vector>
 
 namespace rgb_matrix {
 namespace {
@@ -162,6 +169,319 @@ private:
   int parallel_;
 };
 
+// Binary form of a pixel mapping file. The header is followed by
+// visible_width * visible_height MappedPixels in row-major order.
+// This only saves parsing the text: like any PixelMapper, it is applied
+// once when the matrix is set up. The resulting pixel designators depend
+// on the hardware options, so they are cached separately (see the
+// pixel_mapping_cache option).
+static const char kMappingFileMagic[8] = { 'R','G','B','M','A','P','1','\n' };
+struct MappingFileHeader {
+  char magic[8];
+  int32_t visible_width;
+  int32_t visible_height;
+  int32_t matrix_width;   // Minimum matrix size needed for this mapping.
+  int32_t matrix_height;
+};
+struct MappedPixel {
+  int16_t x, y;   // Position on the matrix. -1: not connected.
+};
+
+// The visible canvas of a mapping file may have holes, but one that is
+// mostly unconnected is more likely a typo in a coordinate. Refuse those
+// instead of allocating a canvas of up to 32768x32768 pixels.
+static const size_t kMaxVisibleAreaFactor = 4;
+
+// Parse the text form of a mapping file into "header" and "pixels".
+static bool ParseMappingCSV(const char *filename, MappingFileHeader *header,
+                            std::vector<MappedPixel> *pixels) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    perror(filename);
+    return false;
+  }
+  struct Entry { int vx, vy, mx, my; };
+  std::vector<Entry> entries;
+  int visible_width = 0, visible_height = 0;
+  int matrix_width = 0, matrix_height = 0;
+  bool success = true;
+  char line[256];
+  for (int line_no = 1; fgets(line, sizeof(line), f); ++line_no) {
+    const char *start = line;
+    while (*start == ' ' || *start == '\t') ++start;
+    if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0')
+      continue;
+    Entry e;
+    if (sscanf(start, "%d , %d , %d , %d", &e.vx, &e.vy, &e.mx, &e.my) != 4
+        || e.vx < 0 || e.vy < 0 || e.mx < 0 || e.my < 0
+        || e.vx > INT16_MAX || e.vy > INT16_MAX
+        || e.mx > INT16_MAX || e.my > INT16_MAX) {
+      fprintf(stderr, "%s:%d: expected visible_x,visible_y,matrix_x,matrix_y\n",
+              filename, line_no);
+      success = false;
+      break;
+    }
+    if (e.vx >= visible_width) visible_width = e.vx + 1;
+    if (e.vy >= visible_height) visible_height = e.vy + 1;
+    if (e.mx >= matrix_width) matrix_width = e.mx + 1;
+    if (e.my >= matrix_height) matrix_height = e.my + 1;
+    entries.push_back(e);
+  }
+  fclose(f);
+  if (!success) return false;
+  if (entries.empty()) {
+    fprintf(stderr, "%s: no pixels mapped\n", filename);
+    return false;
+  }
+  if ((size_t)visible_width * visible_height
+      > kMaxVisibleAreaFactor * entries.size()) {
+    fprintf(stderr, "%s: visible area %dx%d is too large for the %d mapped "
+            "pixels\n", filename, visible_width, visible_height,
+            (int)entries.size());
+    return false;
+  }
+
+  memcpy(header->magic, kMappingFileMagic, sizeof(header->magic));
+  header->visible_width = visible_width;
+  header->visible_height = visible_height;
+  header->matrix_width = matrix_width;
+  header->matrix_height = matrix_height;
+  MappedPixel unconnected;
+  unconnected.x = unconnected.y = -1;
+  pixels->assign(visible_width * visible_height, unconnected);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry &e = entries[i];
+    MappedPixel &p = (*pixels)[e.vy * visible_width + e.vx];
+    if (p.x >= 0) {
+      fprintf(stderr, "%s: visible pixel (%d,%d) mapped more than once\n",
+              filename, e.vx, e.vy);
+      return false;
+    }
+    p.x = e.mx;
+    p.y = e.my;
+  }
+  return true;
+}
+
+// A mapping loaded from a file, to support arbitrary layouts without having
+// to write a PixelMapper or chaining a bunch of them.
+// Parameter is the filename; it is either
+//  - a text file with one "visible_x,visible_y,matrix_x,matrix_y" line per
+//    pixel. Empty lines and lines starting with '#' are ignored. Visible
+//    pixels that are not mentioned are not connected; at least a quarter
+//    of the visible area has to be mapped.
+//  - the compiled binary form created with CompilePixelMappingFile().
+class FileMapper : public PixelMapper {
+public:
+  FileMapper() : pixels_(NULL), mmap_base_(NULL), mmap_size_(0) {}
+  virtual ~FileMapper() { Reset(); }
+
+  virtual const char *GetName() const { return "File"; }
+
+  virtual bool SetParameters(int chain, int parallel, const char *param) {
+    Reset();
+    if (param == NULL || strlen(param) == 0) {
+      fprintf(stderr, "File: need filename of the mapping as parameter\n");
+      return false;
+    }
+    bool is_compiled;
+    if (LoadCompiled(param, &is_compiled))
+      return true;
+    if (is_compiled)
+      return false;  // Not worth trying to parse as text.
+    if (!ParseMappingCSV(param, &header_, &storage_))
+      return false;
+    pixels_ = &storage_[0];
+    return true;
+  }
+
+  virtual bool GetSizeMapping(int matrix_width, int matrix_height,
+                              int *visible_width, int *visible_height)
+    const {
+    if (matrix_width < header_.matrix_width ||
+        matrix_height < header_.matrix_height) {
+      fprintf(stderr, "%s: mapping needs a matrix of at least %dx%d, "
+              "but it is only %dx%d\n", GetName(),
+              header_.matrix_width, header_.matrix_height,
+              matrix_width, matrix_height);
+      return false;
+    }
+    *visible_width = header_.visible_width;
+    *visible_height = header_.visible_height;
+    return true;
+  }
+
+  virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
+                                  int x, int y,
+                                  int *matrix_x, int *matrix_y) const {
+    const MappedPixel &p = pixels_[y * header_.visible_width + x];
+    *matrix_x = p.x;
+    *matrix_y = p.y;
+  }
+
+private:
+  // Try to map a compiled mapping file. Returns 'false' if this is not
+  // a compiled file or it is corrupt; "*is_compiled" tells which.
+  bool LoadCompiled(const char *filename, bool *is_compiled) {
+    *is_compiled = false;
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat s;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &s) == 0 && (size_t)s.st_size >= sizeof(kMappingFileMagic)) {
+      base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const MappingFileHeader *header = (const MappingFileHeader*) base;
+    if (memcmp(header->magic, kMappingFileMagic, sizeof(header->magic)) != 0) {
+      munmap(base, s.st_size);
+      return false;
+    }
+    *is_compiled = true;
+    if ((size_t)s.st_size < sizeof(MappingFileHeader)
+        || header->visible_width <= 0 || header->visible_height <= 0
+        || (size_t)s.st_size != sizeof(MappingFileHeader)
+        + (size_t)header->visible_width * header->visible_height
+        * sizeof(MappedPixel)) {
+      fprintf(stderr, "%s: corrupt compiled mapping file\n", filename);
+      munmap(base, s.st_size);
+      return false;
+    }
+    header_ = *header;
+    pixels_ = (const MappedPixel*) (header + 1);
+    mmap_base_ = base;
+    mmap_size_ = s.st_size;
+
+    // Entries out of range would end up outside of the matrix.
+    for (int i = 0; i < header_.visible_width * header_.visible_height; ++i) {
+      const MappedPixel &p = pixels_[i];
+      if (p.x >= header_.matrix_width || p.y >= header_.matrix_height ||
+          (p.x < 0) != (p.y < 0)) {
+        fprintf(stderr, "%s: invalid entry for visible pixel (%d,%d)\n",
+                filename, i % header_.visible_width,
+                i / header_.visible_width);
+        Reset();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Reset() {
+    if (mmap_base_) munmap(mmap_base_, mmap_size_);
+    mmap_base_ = NULL;
+    mmap_size_ = 0;
+    pixels_ = NULL;
+    storage_.clear();
+    memset(&header_, 0, sizeof(header_));
+  }
+
+  MappingFileHeader header_;
+  const MappedPixel *pixels_;        // Either in storage_ or mmap()ed.
+  std::vector<MappedPixel> storage_;
+  void *mmap_base_;
+  size_t mmap_size_;
+};
+
+// Arrange a wall of panels, given as parameter "<width>x<height>" in
+// panels, over all the parallel chains, so that all chains are about the
+// same length. Refresh rate depends on the length of the chain, so this
+// is the fastest way to drive a given wall.
+//
+// Panels are wired in a snake: starting at the top right (looking at the
+// front), the first row is chained towards the left, the next row
+// back towards the right with panels upside down (like the U-mapper) and
+// so on. The first chain starts at the top right, each following chain
+// continues where the previous one ended.
+// With a parameter suffix ",Z" all rows are wired right to left with all
+// panels upright instead.
+//
+// Usually, the chain and parallel is set with the --led-wall flag.
+//
+// A 4x3 wall with --led-chain=4 --led-parallel=3
+//   [<][<][<][<]  }-- Pi connector #1
+//   [>][>][>][>]  }-- Pi connector #2 (connects at the left)
+//   [<][<][<][<]  }-- Pi connector #3
+class BalancedChainMapper : public PixelMapper {
+public:
+  BalancedChainMapper()
+    : chain_(1), parallel_(1), panels_x_(1), panels_y_(1), snake_(true) {}
+
+  virtual const char *GetName() const { return "Balanced"; }
+
+  virtual bool SetParameters(int chain, int parallel, const char *param) {
+    char order[2] = { 0, 0 };
+    if (param == NULL
+        || sscanf(param, "%dx%d,%1s", &panels_x_, &panels_y_, order) < 2
+        || panels_x_ < 1 || panels_y_ < 1
+        || (order[0] != 0 && order[0] != 'Z' && order[0] != 'z')) {
+      fprintf(stderr, "Balanced: expected parameter <width>x<height>[,Z] "
+              "with the size of the wall in panels\n");
+      return false;
+    }
+    if (panels_x_ * panels_y_ > chain * parallel) {
+      fprintf(stderr, "Balanced: %dx%d panels do not fit on %d chain%s of "
+              "%d panels; use --led-wall=%dx%d to find the best setting.\n",
+              panels_x_, panels_y_, parallel, parallel > 1 ? "s" : "", chain,
+              panels_x_, panels_y_);
+      return false;
+    }
+    snake_ = (order[0] == 0);
+    chain_ = chain;
+    parallel_ = parallel;
+    return true;
+  }
+
+  virtual bool GetSizeMapping(int matrix_width, int matrix_height,
+                              int *visible_width, int *visible_height)
+    const {
+    if (matrix_width % chain_ != 0 || matrix_height % parallel_ != 0) {
+      fprintf(stderr, "%s: matrix %dx%d does not divide into %dx%d panels\n",
+              GetName(), matrix_width, matrix_height, chain_, parallel_);
+      return false;
+    }
+    *visible_width = panels_x_ * (matrix_width / chain_);
+    *visible_height = panels_y_ * (matrix_height / parallel_);
+    return true;
+  }
+
+  virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
+                                  int x, int y,
+                                  int *matrix_x, int *matrix_y) const {
+    const int panel_width = matrix_width / chain_;
+    const int panel_height = matrix_height / parallel_;
+    const int panel_x = x / panel_width;
+    const int panel_y = y / panel_height;
+    x %= panel_width;
+    y %= panel_height;
+
+    // Position of the panel in the sequence of all panels.
+    const bool upside_down = snake_ && (panel_y % 2 == 1);
+    const int pos_in_row = upside_down ? panel_x : panels_x_ - panel_x - 1;
+    const int sequence = panel_y * panels_x_ + pos_in_row;
+
+    // Position 0 in a chain is next to the connector, which is the right-most
+    // panel of the matrix.
+    const int chain_pos = chain_ - (sequence % chain_) - 1;
+    const int parallel = sequence / chain_;
+    if (upside_down) {
+      x = panel_width - x - 1;
+      y = panel_height - y - 1;
+    }
+    *matrix_x = chain_pos * panel_width + x;
+    *matrix_y = parallel * panel_height + y;
+  }
+
+private:
+  int chain_;
+  int parallel_;
+  int panels_x_;
+  int panels_y_;
+  bool snake_;
+};
+
 typedef std::map<std::string, PixelMapper*> MapperByName;
 static void RegisterPixelMapperInternal(MapperByName *registry,
                                         PixelMapper *mapper) {
@@ -178,6 +498,8 @@ static MapperByName *CreateMapperMap() {
   // Register all the default PixelMappers here.
   RegisterPixelMapperInternal(result, new RotatePixelMapper());
   RegisterPixelMapperInternal(result, new UArrangementMapper());
+  RegisterPixelMapperInternal(result, new FileMapper());
+  RegisterPixelMapperInternal(result, new BalancedChainMapper());
   return result;
 }
 
@@ -217,4 +539,34 @@ const PixelMapper *FindPixelMapper(const char *name,
     return NULL;   // Got parameter, but couldn't deal with it.
   return mapper;
 }
+
+bool CompilePixelMappingFile(const char *csv_filename,
+                             const char *compiled_filename) {
+  MappingFileHeader header;
+  std::vector<MappedPixel> pixels;
+  if (!ParseMappingCSV(csv_filename, &header, &pixels))
+    return false;
+  // Write to a temporary file first, so that a running program that mmap()s
+  // the compiled file never sees it half-written.
+  const std::string tmp_filename = std::string(compiled_filename) + ".tmp";
+  FILE *out = fopen(tmp_filename.c_str(), "wb");
+  if (out == NULL) {
+    perror(tmp_filename.c_str());
+    return false;
+  }
+  bool success = (fwrite(&header, sizeof(header), 1, out) == 1
+                  && fwrite(&pixels[0], sizeof(MappedPixel), pixels.size(), out)
+                  == pixels.size());
+  success &= (fclose(out) == 0);
+  if (success && rename(tmp_filename.c_str(), compiled_filename) != 0) {
+    perror(compiled_filename);
+    unlink(tmp_filename.c_str());
+    return false;
+  }
+  if (!success) {
+    fprintf(stderr, "%s: write error\n", tmp_filename.c_str());
+    unlink(tmp_filename.c_str());
+  }
+  return success;
+}
 }  // namespace rgb_matrix
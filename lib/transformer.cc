@@ -27,6 +27,9 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "transformer.h"
 
 namespace rgb_matrix {
@@ -46,10 +49,16 @@ public:
   virtual void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(const Pixel *pixels, int count);
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb);
 
 private:
+  void MapPixel(int x, int y, int *x_out, int *y_out) const;
+
   Canvas *delegatee_;
   int angle_;
+  std::vector<Pixel> pixel_buffer_;   // Transformed pixels for delegatee.
+  std::vector<uint8_t> row_buffer_;   // Reversed row for delegatee.
 };
 
 RotateTransformer::TransformCanvas::TransformCanvas(int angle)
@@ -61,22 +70,72 @@ void RotateTransformer::TransformCanvas::SetDelegatee(Canvas* delegatee) {
   delegatee_ = delegatee;
 }
 
-void RotateTransformer::TransformCanvas::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+void RotateTransformer::TransformCanvas::MapPixel(int x, int y,
+                                                  int *x_out, int *y_out) const {
   switch (angle_) {
   case 0:
-    delegatee_->SetPixel(x, y, red, green, blue);
+    *x_out = x;
+    *y_out = y;
     break;
   case 90:
-    delegatee_->SetPixel(delegatee_->width() - y - 1, x,
-                         red, green, blue);
+    *x_out = delegatee_->width() - y - 1;
+    *y_out = x;
     break;
   case 180:
-    delegatee_->SetPixel(delegatee_->width() - x - 1,
-                         delegatee_->height() - y - 1,
-                         red, green, blue);
+    *x_out = delegatee_->width() - x - 1;
+    *y_out = delegatee_->height() - y - 1;
     break;
   case 270:
-    delegatee_->SetPixel(y, delegatee_->height() - x - 1, red, green, blue);
+    *x_out = y;
+    *y_out = delegatee_->height() - x - 1;
+    break;
+  }
+}
+
+void RotateTransformer::TransformCanvas::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+  MapPixel(x, y, &x, &y);
+  delegatee_->SetPixel(x, y, red, green, blue);
+}
+
+void RotateTransformer::TransformCanvas::SetPixels(const Pixel *pixels,
+                                                   int count) {
+  if (count <= 0) return;
+  pixel_buffer_.assign(pixels, pixels + count);
+  for (int i = 0; i < count; ++i) {
+    Pixel &p = pixel_buffer_[i];
+    MapPixel(p.x, p.y, &p.x, &p.y);
+  }
+  delegatee_->SetPixels(&pixel_buffer_[0], count);
+}
+
+void RotateTransformer::TransformCanvas::SetRow(int x, int y, int length,
+                                                const uint8_t *rgb) {
+  if (length <= 0) return;
+  switch (angle_) {
+  case 0:
+    delegatee_->SetRow(x, y, length, rgb);
+    break;
+  case 180:
+    // Still a row, but reversed.
+    row_buffer_.resize(3 * length);
+    for (int i = 0; i < length; ++i) {
+      const uint8_t *from = rgb + 3 * (length - i - 1);
+      std::copy(from, from + 3, &row_buffer_[3 * i]);
+    }
+    delegatee_->SetRow(delegatee_->width() - x - length,
+                       delegatee_->height() - y - 1, length, &row_buffer_[0]);
+    break;
+  default:
+    // Row became a column, so pass on as individual pixels.
+    pixel_buffer_.resize(length);
+    for (int i = 0; i < length; ++i, rgb += 3) {
+      Pixel &p = pixel_buffer_[i];
+      MapPixel(x + i, y, &p.x, &p.y);
+      p.red = rgb[0];
+      p.green = rgb[1];
+      p.blue = rgb[2];
+    }
+    delegatee_->SetPixels(&pixel_buffer_[0], length);
     break;
   }
 }
@@ -166,13 +225,20 @@ public:
   virtual int width() const { return width_; }
   virtual int height() const { return height_; }
   virtual void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(const Pixel *pixels, int count);
+  virtual void SetRow(int x, int y, int length, const uint8_t *rgb);
 
 private:
+  // Map pixel to the delegatee. Returns 'false' if outside of canvas.
+  bool MapPixel(int x, int y, int *x_out, int *y_out) const;
+
   const int parallel_;
   int width_;
   int height_;
   int panel_height_;
   Canvas *delegatee_;
+  std::vector<Pixel> pixel_buffer_;   // Transformed pixels for delegatee.
+  std::vector<uint8_t> row_buffer_;   // Reversed row for delegatee.
 };
 
 void UArrangementTransformer::TransformCanvas::SetDelegatee(Canvas* delegatee) {
@@ -200,9 +266,9 @@ void UArrangementTransformer::TransformCanvas::Fill(
   delegatee_->Fill(red, green, blue);
 }
 
-void UArrangementTransformer::TransformCanvas::SetPixel(
-  int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
-  if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+bool UArrangementTransformer::TransformCanvas::MapPixel(
+  int x, int y, int *x_out, int *y_out) const {
+  if (x < 0 || x >= width_ || y < 0 || y >= height_) return false;
   const int slab_height = 2*panel_height_;   // one folded u-shape
   const int base_y = (y / slab_height) * panel_height_;
   y %= slab_height;
@@ -212,7 +278,55 @@ void UArrangementTransformer::TransformCanvas::SetPixel(
     x = width_ - x - 1;
     y = slab_height - y - 1;
   }
-  delegatee_->SetPixel(x, base_y + y, red, green, blue);
+  *x_out = x;
+  *y_out = base_y + y;
+  return true;
+}
+
+void UArrangementTransformer::TransformCanvas::SetPixel(
+  int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+  if (MapPixel(x, y, &x, &y)) {
+    delegatee_->SetPixel(x, y, red, green, blue);
+  }
+}
+
+void UArrangementTransformer::TransformCanvas::SetPixels(const Pixel *pixels,
+                                                         int count) {
+  pixel_buffer_.resize(count > 0 ? count : 0);
+  int mapped = 0;
+  for (int i = 0; i < count; ++i) {
+    Pixel p = pixels[i];
+    if (MapPixel(p.x, p.y, &p.x, &p.y)) {
+      pixel_buffer_[mapped++] = p;
+    }
+  }
+  if (mapped > 0) delegatee_->SetPixels(&pixel_buffer_[0], mapped);
+}
+
+void UArrangementTransformer::TransformCanvas::SetRow(int x, int y, int length,
+                                                      const uint8_t *rgb) {
+  if (y < 0 || y >= height_) return;
+  if (x < 0) {
+    length += x;
+    rgb -= 3 * x;
+    x = 0;
+  }
+  if (x + length > width_) length = width_ - x;
+  if (length <= 0) return;
+  int mapped_x, mapped_y;
+  MapPixel(x, y, &mapped_x, &mapped_y);
+  if ((y % (2*panel_height_)) < panel_height_) {
+    delegatee_->SetRow(mapped_x, mapped_y, length, rgb);
+  } else {
+    // Lower half of the U is upside down, so the row is reversed.
+    row_buffer_.resize(3 * length);
+    for (int i = 0; i < length; ++i) {
+      const uint8_t *from = rgb + 3 * (length - i - 1);
+      std::copy(from, from + 3, &row_buffer_[3 * i]);
+    }
+    delegatee_->SetRow(mapped_x - length + 1, mapped_y, length,
+                       &row_buffer_[0]);
+  }
 }
 
 UArrangementTransformer::UArrangementTransformer(int parallel)
@@ -0,0 +1,36 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Compile a BDF font into the binary form that can be loaded quickly with
+// Font::LoadCompiledFont().
+
+#include "graphics.h"
+
+#include <stdio.h>
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s <font.bdf> <compiled-font>\n", progname);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) return usage(argv[0]);
+  rgb_matrix::Font font;
+  if (!font.LoadFont(argv[1])) {
+    fprintf(stderr, "Couldn't load font '%s'\n", argv[1]);
+    return 1;
+  }
+  return font.WriteCompiledFont(argv[2]) ? 0 : 1;
+}
@@ -83,6 +83,19 @@ static cv::Vec3b FindNearestColor(cv::Vec3b received_color) {
   return nearest_color;
 }
 
+// Index of color in the canvas palette: 0 is black, followed by the
+// available_colors.
+static uint8_t PaletteIndex(const float *bgr) {
+  for (size_t i = 0; i < available_colors.size(); ++i) {
+    const cv::Vec3b &color = available_colors[i];
+    if (color.val[0] == bgr[0] && color.val[1] == bgr[1] &&
+        color.val[2] == bgr[2]) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
 static int usage(const char *progname) {
   fprintf(stderr, "usage: %s [options]\n", progname);
 
@@ -131,6 +144,13 @@ int main(int argc, char *argv[]) {
   // Set up offscreen canvas
   FrameCanvas *offscreen_canvas = canvas->CreateFrameCanvas();
 
+  // We only show the available colors, so they are set up once in the
+  // palette of all canvases and then written by index.
+  for (size_t i = 0; i < available_colors.size(); ++i) {
+    const cv::Vec3b &color = available_colors[i];
+    canvas->SetPaletteColor(i + 1, color.val[2], color.val[1], color.val[0]);
+  }
+
   printf("Size: %dx%d. Hardware gpio mapping: %s\n", canvas->width(), canvas->height(), matrix_options.hardware_mapping);
 
   // Interrupt Handler
@@ -353,10 +373,12 @@ int main(int argc, char *argv[]) {
     }
 
     // Display Image
+    uint8_t row[64];
     for (size_t y = 0; y < 64; ++y) {
       for (size_t x = 0; x < 64; ++x) {
-        offscreen_canvas->SetPixel(x, y, (int)pixels[x][y][2], (int)pixels[x][y][1], (int)pixels[x][y][0]);
+        row[x] = PaletteIndex(pixels[x][y]);
       }
+      offscreen_canvas->SetIndexedRow(0, y, 64, row);
     }
     
     offscreen_canvas = canvas->SwapOnVSync(offscreen_canvas);
@@ -0,0 +1,34 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Compile a text pixel mapping for --led-pixel-mapper=File:<filename>
+// into the binary form that is quicker to load.
+
+#include "pixel-mapper.h"
+
+#include <stdio.h>
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s <mapping.csv> <mapping.bin>\n", progname);
+  fprintf(stderr, "Each line of the input is visible_x,visible_y,"
+          "matrix_x,matrix_y\n"
+          "Empty lines and lines starting with '#' are ignored.\n");
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) return usage(argv[0]);
+  return rgb_matrix::CompilePixelMappingFile(argv[1], argv[2]) ? 0 : 1;
+}